@@ -19,35 +19,407 @@
 #pragma once
 
 #include <dirt/surfacegroup.h>
+#include <dirt/widebbh.h>
 #include <dirt/progress.h>
+#include <dirt/stats.h>
 
-class BBHNode : public Surface
+class BinaryReader;
+class BinaryWriter;
+
+/**
+    A node of a flattened BBH.
+
+    Nodes are stored in depth-first order in a single array, so the first
+    child of an interior node immediately follows it and only the offset of
+    the second child needs to be stored. Leaves instead reference a
+    contiguous range of primitives.
+ */
+struct LinearBBHNode
 {
-    Box3f m_bounds;
-    shared_ptr<SurfaceBase> m_left;
-    shared_ptr<SurfaceBase> m_right;
+    Box3f bounds;                       ///< Bounds of everything below this node
+    union
+    {
+        uint32_t primitivesOffset;      ///< Leaf: index of the first primitive
+        uint32_t secondChildOffset;     ///< Interior: index of the second child
+    };
+    uint16_t numPrimitives;             ///< Number of primitives (0 for interior nodes)
+    uint8_t axis;                       ///< Split axis of interior nodes
+    uint8_t pad;                        ///< Pad the node to 32 bytes
+
+    bool isLeaf() const {return numPrimitives > 0;}
+};
+
+static_assert(sizeof(LinearBBHNode) == 32, "LinearBBHNode should be 32 bytes");
+
+/**
+    A flattened bounding box hierarchy over an abstract set of primitives.
+
+    The tree only refers to its primitives by index, so it is shared by
+    the scene-level BBH and by TriangleMesh, which builds one over its faces.
 
+    The hierarchy is built top-down. How each node's primitives are divided
+    between its two children is chosen with the "split" parameter:
+
+    - "sah":    minimize the surface area heuristic over "bins" equally
+                sized centroid bins along the widest axis (the default)
+    - "median": split at the median centroid along the widest axis
+    - "random": split at the median centroid along a random axis
+
+    Nodes with at most "max_leaf_size" primitives become leaves (with SAH
+    splitting, only if that is cheaper than splitting them further). The
+    tree is built with "build_threads" threads (by default one per core);
+    the result does not depend on this number. The
+    finished tree is flattened into a contiguous array of LinearBBHNodes
+    which is traversed without recursion.
+
+    The "type" of the accelerator selects the branching factor of the tree
+    that is traversed. "bbh" (or "bvh") keeps the binary tree, while "qbvh"
+    and "obvh" collapse it into a 4- or 8-wide tree of WideBBHNodes whose
+    children are tested against a ray together with SSE or AVX (or a
+    portable fallback when those are not available).
+*/
+class LinearBBH
+{
 public:
-    BBHNode(vector<shared_ptr<SurfaceBase>> primitives, Progress & progress);
-    ~BBHNode();
+    enum class SplitMethod
+    {
+        SAH,
+        Median,
+        Random
+    };
+
+    /// Read the "type", "split", "bins" and "max_leaf_size" build parameters from \a j
+    explicit LinearBBH(const json & j = json::object());
+
+    /**
+        Build the tree over primitives with the given world-space \a bounds.
+
+        \return The primitive indices in leaf order. Each leaf references a
+                contiguous range of this array, so callers should store
+                their primitives in this order.
+     */
+    vector<uint32_t> build(const vector<Box3f> & bounds);
+
+    /**
+        Visit the leaves of the tree pierced by \a query in front-to-back order.
+
+        \a visitLeaf is called with the range [begin, end) of primitive
+        indices (into the array returned by build()) of each leaf. It may
+        shrink query.ray.maxt as it finds hits; a node whose box is entered beyond
+        the updated maxt is then skipped along with its whole subtree.
+        Traversal stops early if \a visitLeaf returns true.
+     */
+    template <typename LeafVisitor>
+    void traverse(const RayQuery3f & query, LeafVisitor && visitLeaf) const
+    {
+        if (m_width == 4)
+            traverseWide(m_wideNodes4, query, visitLeaf);
+        else if (m_width == 8)
+            traverseWide(m_wideNodes8, query, visitLeaf);
+        else
+            traverseBinary(query, visitLeaf);
+    }
+
+    /**
+        Visit the leaves pierced by the rays of \a packet selected by \a mask.
+
+        \a visitLeaf is called with the primitive range [begin, end) of each
+        leaf and the mask of the rays that hit its box, and returns the mask
+        of those rays that need no further traversal (e.g. occluded rays).
+        Each box is tested against all active rays at once, and once a
+        subtree is entered by a single ray it is traversed with the
+        single-ray traversal. Wide trees trace the rays one by one, since
+        they already test several boxes at once per ray.
+     */
+    template <typename LeafVisitor>
+    void traverse(const RayPacket & packet, uint32_t mask, LeafVisitor && visitLeaf) const;
+
+    /// Bounds of the whole tree
+    Box3f bounds() const {return m_bounds;}
+
+    /// Write the built tree to \a writer
+    void write(BinaryWriter & writer) const;
+
+    /**
+        Read a tree over \a numPrimitives primitives written by write() from \a reader.
+
+        Throws a DirtException if a node refers to a node or primitive
+        range outside the stored arrays, so a damaged file never leads to
+        out-of-bounds accesses during traversal.
+
+        \return false (leaving this tree empty) if the stored tree was built
+                with different "type", "split", "bins" or "max_leaf_size"
+                parameters than this one, so it needs to be rebuilt.
+     */
+    bool read(BinaryReader & reader, size_t numPrimitives);
+
+    /// Memory used by the nodes, in bytes
+    size_t memoryUsage() const
+    {
+        return m_nodes.size() * sizeof(LinearBBHNode) +
+               m_wideNodes4.size() * sizeof(WideBBHNode<4>) +
+               m_wideNodes8.size() * sizeof(WideBBHNode<8>);
+    }
+
+private:
+    /// Build information for a single primitive
+    struct BuildPrimitive
+    {
+        Box3f bounds;
+        Vec3f centroid;
+        uint32_t index;
+    };
+
+    uint32_t buildRecursive(vector<LinearBBHNode> & nodes,
+                            vector<BuildPrimitive> & primitives,
+                            size_t start, size_t end, int depth,
+                            int numThreads, Progress & progress) const;
+    size_t partition(vector<BuildPrimitive> & primitives,
+                     size_t start, size_t end, SplitMethod method,
+                     int chunks, int & axis, float & cost) const;
+
+    template <int N>
+    uint32_t collapse(vector<WideBBHNode<N>> & wideNodes, uint32_t nodeIndex) const;
+
+    /// Throw if a node of the read tree refers outside of the node or primitive arrays
+    void validate(size_t numPrimitives) const;
+    template <int N>
+    void validateWide(const vector<WideBBHNode<N>> & nodes, size_t numPrimitives) const;
 
-    bool intersect(const Ray3f &ray, HitInfo &hit) const override;
+    template <typename LeafVisitor>
+    void traverseBinary(const RayQuery3f & query, LeafVisitor && visitLeaf,
+                        uint32_t root = 0) const;
+    template <int N, typename LeafVisitor>
+    void traverseWide(const vector<WideBBHNode<N>> & nodes,
+                      const RayQuery3f & query, LeafVisitor && visitLeaf) const;
 
-    Box3f localBBox() const override { return m_bounds; }
-    Box3f worldBBox() const override { return m_bounds; }
+    static const int MaxTraversalDepth = 128;
+
+    vector<LinearBBHNode> m_nodes;          ///< The flattened binary tree, root first
+    vector<WideBBHNode<4>> m_wideNodes4;    ///< The collapsed tree if m_width is 4
+    vector<WideBBHNode<8>> m_wideNodes8;    ///< The collapsed tree if m_width is 8
+    Box3f m_bounds;
+    int m_width = 2;                        ///< branching factor of the traversed tree
+    SplitMethod m_splitMethod = SplitMethod::SAH;
+    int m_numBins = 16;                     ///< number of SAH bins per split
+    int m_maxLeafSize = 4;                  ///< maximum primitives per leaf
+    int m_buildThreads = 0;                 ///< threads used for building (0: one per core)
 };
 
-/// An axis-aligned bounding box hierarchy acceleration structure
+/**
+    An axis-aligned bounding box hierarchy acceleration structure
+
+    Builds a LinearBBH over the world-space bounds of its child surfaces;
+    see LinearBBH for the accepted parameters.
+*/
 class BBH: public SurfaceGroup
 {
-    shared_ptr<BBHNode> m_root;
-
 public:
     BBH(const Scene & scene, const json & j = json::object());
 
     /// Construct the BBH (must be called before @ref intersect)
     void build() override;
 
+    using SurfaceGroup::closestHit;
+    using SurfaceGroup::occluded;
+
     /// Intersect a ray against all surfaces registered with the Accelerator
-    bool intersect(const Ray3f &ray, HitInfo &hit) const override;
+    bool closestHit(const RayQuery3f &query, HitInfo &hit) const override;
+
+    /// Return whether the ray hits any surface registered with the Accelerator
+    bool occluded(const RayQuery3f &query) const override;
+
+    uint32_t closestHit(RayPacket &packet, uint32_t mask, HitInfo hits[]) const override;
+    uint32_t occluded(const RayPacket &packet, uint32_t mask) const override;
+
+private:
+    LinearBBH m_tree;
 };
+
+
+template <typename LeafVisitor>
+void LinearBBH::traverseBinary(const RayQuery3f & query, LeafVisitor && visitLeaf,
+                               uint32_t root) const
+{
+    if (m_nodes.empty())
+        return;
+
+    uint32_t stack[MaxTraversalDepth];
+    int stackSize = 0;
+    uint32_t current = root;
+    while (true)
+    {
+        DIRT_STAT(NodesVisited);
+        DIRT_STAT(BoxTests);
+        const LinearBBHNode & node = m_nodes[current];
+        if (node.bounds.intersect(query))
+        {
+            if (node.isLeaf())
+            {
+                if (visitLeaf(node.primitivesOffset, node.primitivesOffset + node.numPrimitives))
+                    return;
+            }
+            else
+            {
+                // visit the near child next, and the far one later
+                if (query.sign[node.axis])
+                {
+                    stack[stackSize++] = current + 1;
+                    current = node.secondChildOffset;
+                }
+                else
+                {
+                    stack[stackSize++] = node.secondChildOffset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+
+        if (stackSize == 0)
+            break;
+        current = stack[--stackSize];
+    }
+}
+
+template <int N, typename LeafVisitor>
+void LinearBBH::traverseWide(const vector<WideBBHNode<N>> & nodes,
+                             const RayQuery3f & query, LeafVisitor && visitLeaf) const
+{
+    if (nodes.empty())
+        return;
+
+    // a child slot waiting to be visited, and where the ray enters its box
+    struct Entry
+    {
+        float tNear;
+        uint32_t offset;
+        uint16_t count;
+    };
+
+    Entry stack[MaxTraversalDepth * N];
+    int stackSize = 0;
+    stack[stackSize++] = {query.ray.mint, 0, 0};
+    while (stackSize > 0)
+    {
+        const Entry entry = stack[--stackSize];
+
+        // skip boxes entered beyond a hit found in the meantime
+        if (entry.tNear > query.ray.maxt)
+            continue;
+
+        if (entry.count > 0)
+        {
+            if (visitLeaf(entry.offset, entry.offset + entry.count))
+                return;
+            continue;
+        }
+
+        DIRT_STAT(NodesVisited);
+        DIRT_STAT_ADD(BoxTests, N);
+        const WideBBHNode<N> & node = nodes[entry.offset];
+        float tNear[N];
+        int mask = intersectChildren(node, query, tNear);
+
+        // push the hit children far-to-near so the nearest is visited next
+        int first = stackSize;
+        for (int i = 0; i < N; ++i)
+        {
+            if (!(mask & (1 << i)))
+                continue;
+
+            Entry child = {tNear[i], node.offset[i], node.count[i]};
+            int j = stackSize++;
+            for (; j > first && stack[j - 1].tNear < child.tNear; --j)
+                stack[j] = stack[j - 1];
+            stack[j] = child;
+        }
+    }
+}
+
+template <typename LeafVisitor>
+void LinearBBH::traverse(const RayPacket & packet, uint32_t mask, LeafVisitor && visitLeaf) const
+{
+    if (m_width != 2)
+    {
+        for (int k = 0; k < packet.size; ++k)
+            if (mask & (1u << k))
+                traverse(packet.queries[k], [&](uint32_t begin, uint32_t end)
+                {
+                    return visitLeaf(begin, end, 1u << k) != 0;
+                });
+        return;
+    }
+
+    if (m_nodes.empty())
+        return;
+
+    // a node waiting to be visited, and the rays that hit its box
+    struct Entry
+    {
+        uint32_t node;
+        uint32_t rays;
+    };
+
+    Entry stack[MaxTraversalDepth];
+    int stackSize = 0;
+    Entry current = {0, mask};
+    uint32_t finished = 0;
+    while (true)
+    {
+        uint32_t active = current.rays & ~finished;
+        if (active & (active - 1))
+        {
+            DIRT_STAT(NodesVisited);
+            DIRT_STAT_MASK(BoxTests, active);
+            const LinearBBHNode & node = m_nodes[current.node];
+            uint32_t hitRays = 0;
+            int first = -1;
+            for (int k = 0; k < packet.size; ++k)
+            {
+                if ((active & (1u << k)) && node.bounds.intersect(packet.queries[k]))
+                {
+                    hitRays |= 1u << k;
+                    first = first < 0 ? k : first;
+                }
+            }
+
+            if (hitRays && node.isLeaf())
+                finished |= visitLeaf(node.primitivesOffset,
+                                      node.primitivesOffset + node.numPrimitives, hitRays);
+            else if (hitRays)
+            {
+                // order the children for the first of the rays
+                if (packet.queries[first].sign[node.axis])
+                {
+                    stack[stackSize++] = {current.node + 1, hitRays};
+                    current = {node.secondChildOffset, hitRays};
+                }
+                else
+                {
+                    stack[stackSize++] = {node.secondChildOffset, hitRays};
+                    current = {current.node + 1, hitRays};
+                }
+                continue;
+            }
+        }
+        else if (active)
+        {
+            // the packet has diverged down to a single ray
+            int k = 0;
+            while (!(active & (1u << k)))
+                ++k;
+            traverseBinary(packet.queries[k], [&](uint32_t begin, uint32_t end)
+            {
+                if (visitLeaf(begin, end, active) == 0)
+                    return false;
+                finished |= active;
+                return true;
+            }, current.node);
+        }
+
+        if (stackSize == 0)
+            break;
+        current = stack[--stackSize];
+    }
+}
@@ -0,0 +1,154 @@
+/*
+    This file is part of Dirt, the Dartmouth introductory ray tracer.
+
+    Copyright (c) 2017-2019 by Wojciech Jarosz
+
+    Dirt is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Dirt is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <dirt/common.h>
+#include <fstream>
+#include <cstring>
+#include <type_traits>
+
+/**
+    A read-only view of a whole file in memory.
+
+    The file is memory-mapped where the OS supports it, so only the pages
+    that are actually touched get read from disk. On Windows the file is
+    simply read into a buffer.
+ */
+class MemoryMappedFile
+{
+public:
+    /// Map \a filename into memory (throws a DirtException on failure)
+    explicit MemoryMappedFile(const string & filename);
+    ~MemoryMappedFile();
+
+    MemoryMappedFile(const MemoryMappedFile &) = delete;
+    MemoryMappedFile & operator=(const MemoryMappedFile &) = delete;
+
+    const char * data() const {return m_data;}
+    size_t size() const {return m_size;}
+
+private:
+    const char * m_data = nullptr;
+    size_t m_size = 0;
+#if defined(_WIN32)
+    vector<char> m_buffer;
+#endif
+};
+
+
+/**
+    Writes plain-old-data values and arrays to a binary file.
+
+    Arrays are stored as their element count followed by the raw elements,
+    starting at a multiple of \ref Alignment bytes from the start of the
+    file, so they can be used directly from a MemoryMappedFile.
+ */
+class BinaryWriter
+{
+public:
+    static const size_t Alignment = 32;
+
+    /// Create (or truncate) \a filename (throws a DirtException on failure)
+    explicit BinaryWriter(const string & filename);
+
+    template <typename T>
+    void write(const T & value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Only plain data can be written");
+        writeBytes(&value, sizeof(T));
+    }
+
+    template <typename T>
+    void write(const vector<T> & values)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Only plain data can be written");
+        write(uint64_t(values.size()));
+        align();
+        writeBytes(values.data(), values.size() * sizeof(T));
+    }
+
+    /// Flush and close the file (throws a DirtException if anything failed to be written)
+    void close();
+
+private:
+    void writeBytes(const void * data, size_t size);
+    void align();
+
+    string m_filename;
+    std::ofstream m_os;
+    size_t m_offset = 0;
+};
+
+
+/// Reads what a BinaryWriter wrote back from a block of memory, with bounds checks
+class BinaryReader
+{
+public:
+    BinaryReader(const char * data, size_t size) : m_begin(data), m_ptr(data), m_end(data + size) {}
+
+    template <typename T>
+    T read()
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Only plain data can be read");
+        T value;
+        std::memcpy(&value, take(sizeof(T)), sizeof(T));
+        return value;
+    }
+
+    template <typename T>
+    void read(vector<T> & values)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Only plain data can be read");
+        auto count = read<uint64_t>();
+        align();
+        if (count > uint64_t(m_end - m_ptr) / sizeof(T))
+            throw DirtException("Truncated binary file: array of %d elements does not fit.", count);
+        values.resize(count);
+        std::memcpy(values.data(), take(count * sizeof(T)), count * sizeof(T));
+    }
+
+private:
+    const char * take(size_t size)
+    {
+        if (size > size_t(m_end - m_ptr))
+            throw DirtException("Truncated binary file: expected %d more bytes.", size);
+        const char * p = m_ptr;
+        m_ptr += size;
+        return p;
+    }
+
+    void align()
+    {
+        size_t offset = m_ptr - m_begin;
+        take((BinaryWriter::Alignment - offset % BinaryWriter::Alignment) % BinaryWriter::Alignment);
+    }
+
+    const char * m_begin;
+    const char * m_ptr;
+    const char * m_end;
+};
+
+
+/**
+    Replace \a filename by \a tempFile, a completely written new version of it.
+
+    Writing to a temporary file and renaming it means readers, and runs that
+    follow a crash, never see a partially written file.
+ */
+void replaceFile(const string & tempFile, const string & filename);
@@ -60,6 +60,14 @@ struct Box
     Vec<N,T> center() const { return (pMin + pMax) / T(2);}
     Vec<N,T> diagonal() const { return pMax - pMin; }
 
+    /// The surface area of a 3D box (used by the surface area heuristic)
+    T surfaceArea() const
+    {
+        static_assert(N == 3, "surfaceArea() is only defined for 3D boxes");
+        Vec<N,T> d = diagonal();
+        return T(2) * (d[0] * d[1] + d[1] * d[2] + d[2] * d[0]);
+    }
+
     /**
         Compute the intersection of a Ray with an Box
 
@@ -69,23 +77,32 @@ struct Box
     */
     bool intersect(const Ray<N,T> &ray) const
     {
-        T minT = ray.mint;
-        T maxT = ray.maxt;
+        return intersect(RayQuery<N,T>(ray));
+    }
+
+    /**
+        Compute the intersection of a prepared RayQuery with an Box
+
+        The near and far planes of each slab are picked with the precomputed
+        direction signs, so the test is free of divisions and branches.
+
+        \param query	The ray along which to check for intersection
+        \return 		\c true if there is an intersection
+    */
+    bool intersect(const RayQuery<N,T> &query) const
+    {
+        const Vec<N,T> * planes[2] = {&pMin, &pMax};
+        T minT = query.ray.mint;
+        T maxT = query.ray.maxt;
 
         for (size_t i = 0; i < N; ++i)
         {
-            T invD = T(1) / ray.d[i];
-            T t0 = (pMin[i] - ray.o[i]) * invD;
-            T t1 = (pMax[i] - ray.o[i]) * invD;
-            if (invD < 0.0f)
-                std::swap(t0, t1);
-
+            T t0 = (*planes[query.sign[i]])[i] * query.invD[i] + query.negOInvD[i];
+            T t1 = (*planes[1 - query.sign[i]])[i] * query.invD[i] + query.negOInvD[i];
             minT = t0 > minT ? t0 : minT;
             maxT = t1 < maxT ? t1 : maxT;
-            if (maxT < minT)
-                return false;
         }
-        return true;
+        return minT <= maxT;
     }
 };
 
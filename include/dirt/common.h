@@ -305,6 +305,14 @@ std::string timeString(double time, int precision = 2);
 /// Convert a memory amount in bytes into a human-readable string
 std::string memString(size_t size, int precision = 2);
 
+/// Hash \a size bytes at \a data (64-bit FNV-1a), continuing from a previous \a hash
+inline uint64_t hashBytes(const void * data, size_t size, uint64_t hash = 0xcbf29ce484222325ull)
+{
+    for (size_t i = 0; i < size; ++i)
+        hash = (hash ^ static_cast<const unsigned char *>(data)[i]) * 0x100000001b3ull;
+    return hash;
+}
+
 /// Simple exception class, which stores a human-readable error description
 class DirtException: public std::runtime_error
 {
@@ -325,46 +333,16 @@ public:
  */
 filesystem::resolver & getFileResolver();
 
-// Acceleration structure stats parameters
-extern uint64_t intersection_tests;
-extern uint64_t rays_traced;
-
-#define INCREMENT_INTERSECTION_TESTS intersection_tests++
-#define INCREMENT_TRACED_RAYS rays_traced++
-
 
+/**
+    Return a uniformly distributed random float in [0,1).
 
+    This draws from a per-thread generator and is meant for scene setup
+    (procedural textures, test scenes). Rendering code takes its random
+    numbers from a \ref Sampler instead, so that renders are reproducible.
+ */
 inline float randf()
 {
-	static pcg32 globalRNG = pcg32();
-	return globalRNG.nextFloat();
-}
-
-
-inline Vec2f randomInUnitDisk()
-{
-	Vec2f p;
-	do
-	{
-        float a = randf();
-        float b = randf();
-		p = 2.0f * Vec2f(a, b) - Vec2f(1);
-	} while (length2(p) >= 1.f);
-
-	return p;
-}
-
-
-inline Vec3f randomInUnitSphere()
-{
-	Vec3f p;
-	do
-	{
-        float a = randf();
-        float b = randf();
-        float c = randf();
-		p = 2.0f * Vec3f(a, b, c) - Vec3f(1);
-	} while (length2(p) >= 1.0f);
-
-	return p;
+	static thread_local pcg32 rng = pcg32();
+	return rng.nextFloat();
 }
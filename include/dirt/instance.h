@@ -0,0 +1,56 @@
+/*
+    This file is part of Dirt, the Dartmouth introductory ray tracer.
+
+    Copyright (c) 2017-2019 by Wojciech Jarosz
+
+    Dirt is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Dirt is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <dirt/mesh.h>
+
+/**
+    A transformed copy of a shared triangle mesh.
+
+    The mesh (the prototype) is loaded once, in its own object space, and
+    keeps its own BBH. Each instance only stores its "transform" and
+    "material", and transforms rays into the prototype's space to
+    intersect them, like a Sphere does. With the instances placed in the
+    scene's accelerator, this forms a two-level hierarchy: a tree over the
+    instances on top, and one tree per mesh below.
+ */
+class Instance : public Surface
+{
+public:
+    Instance(const Scene & scene, const json & j, shared_ptr<const TriangleMesh> prototype);
+
+    Box3f localBBox() const override {return m_prototype->localBBox();}
+
+    using SurfaceBase::closestHit;
+    using SurfaceBase::occluded;
+    bool closestHit(const Ray3f &ray, HitInfo &hit) const override;
+    uint32_t closestHit(RayPacket &packet, uint32_t mask, HitInfo hits[]) const override;
+    void computeSurfaceInteraction(const Ray3f &ray, HitInfo &hit) const override;
+    bool occluded(const Ray3f &ray) const override;
+    uint32_t occluded(const RayPacket &packet, uint32_t mask) const override;
+
+    bool isEmissive() const override {return m_material && m_material->isEmissive();}
+
+protected:
+    /// Transform the selected rays of \a packet into the prototype's space
+    RayPacket toLocal(const RayPacket & packet, uint32_t mask) const;
+
+    shared_ptr<const TriangleMesh> m_prototype;
+    shared_ptr<const Material> m_material;
+};
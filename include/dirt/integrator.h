@@ -4,74 +4,131 @@
 class Integrator
 {
 public:
-	virtual Color3f Li(const Scene& scene, const Ray3f& ray,int depth=0)const
+	/// Radiance arriving along \a ray, tracing the ray to find its closest hit
+	virtual Color3f Li(const Scene& scene, Sampler& sampler, const Ray3f& ray,int depth=0)const
+	{
+		HitInfo hit;
+		auto f = scene.intersect(ray, hit);
+		return shade(scene, sampler, ray, f ? &hit : nullptr, depth);
+	}
+
+	/**
+		Radiance arriving along \a ray, whose closest hit \a hit has already
+		been found (e.g. by tracing a packet of camera rays). \a hit is
+		nullptr if the ray escapes the scene.
+	*/
+	virtual Color3f shade(const Scene& scene, Sampler& sampler, const Ray3f& ray, const HitInfo* hit, int depth=0)const
 	{
 		return Color3f(1, 0, 1);
 	}
+
+	/**
+		\ref shade() for a whole batch of \a count camera paths at once.
+
+		Path k starts with ray \a rays[k] with closest hit \a hits[k] (nullptr
+		if it escapes), draws its random numbers from \a samplers[k], and its
+		estimate is written to \a colors[k]. Integrators that process paths
+		in stages override this; the base class shades them one by one.
+	*/
+	virtual void shadeBatch(const Scene& scene, int count, Sampler samplers[], const Ray3f rays[],
+	                        const HitInfo* const hits[], Color3f colors[])const
+	{
+		for (int k = 0; k < count; ++k)
+			colors[k] = shade(scene, samplers[k], rays[k], hits[k]);
+	}
 };
 
 class NormalIntegrator :public Integrator
 {
 public:
-	Color3f Li(const Scene& scene, const Ray3f& ray,int depth=0)const
+	Color3f shade(const Scene& scene, Sampler& sampler, const Ray3f& ray, const HitInfo* hit, int depth=0)const
 	{
-		HitInfo hit;
-		auto f = scene.intersect(ray, hit);
-		if (f)return abs(hit.gn);
+		if (hit)return abs(hit->gn);
 		else return scene.background();
 	}
 };
 class AmbientOcclusionIntegrator :public Integrator
 {
+	int m_samples = 1;
 public:
-	Color3f Li(const Scene& scene, const Ray3f& ray,int depth=0)const
+	AmbientOcclusionIntegrator(const json& j = json::object()) {
+		m_samples = j.value("samples", m_samples);
+		if (m_samples < 1)
+			throw DirtException("AO 'samples' must be at least 1 here:\n%s.", j.dump(4));
+	}
+	Color3f shade(const Scene& scene, Sampler& sampler, const Ray3f& ray, const HitInfo* hit, int depth=0)const
 	{
-		HitInfo hit;
-		ScatterRecord srec;
-		auto f = scene.intersect(ray, hit);
-		if (f)
+		if (!hit)
+			return scene.background();
+
+		// the shadow rays all leave the same point, so trace them in packets
+		int unoccluded = 0;
+		for (int first = 0; first < m_samples; first += RayPacket::MaxSize)
 		{
-			hit.mat->sample(-ray.d, hit, srec);
-			Ray3f scattered(hit.p,srec.scattered);
-			if (scene.intersect(scattered, hit))
-				return Color3f(0,0,0);
-			else return Color3f(1,1,1);
+			RayPacket packet;
+			for (int i = first; i < min(m_samples, first + RayPacket::MaxSize); ++i)
+			{
+				ScatterRecord srec;
+				hit->mat->sample(-ray.d, *hit, srec, sampler);
+				packet.add(Ray3f(hit->p, srec.scattered));
+			}
+
+			uint32_t occluded = scene.occluded(packet, packet.mask());
+			for (int k = 0; k < packet.size; ++k)
+				unoccluded += (occluded & (1u << k)) ? 0 : 1;
 		}
-		else return scene.background();
+		return Color3f(float(unoccluded) / m_samples);
 	}
 };
 class PathTracerMaterials :public Integrator
 {
 	int MaxDepth;
+	int RouletteDepth;	///< bounces before Russian roulette may terminate a path
 public:
 	PathTracerMaterials(const json& j) {
 		MaxDepth = j.at("max_bounces");
+		RouletteDepth = j.value("roulette_depth", 5);
 	}
-	Color3f Li(const Scene& scene, const Ray3f& ray,int depth=0)const
+	Color3f shade(const Scene& scene, Sampler& sampler, const Ray3f& ray, const HitInfo* hitp, int depth=0)const
 	{
-		HitInfo hit;	
-		if (scene.intersect(ray, hit))
+		// follow the path forward, weighting what it finds by the product of the path weights so far
+		Color3f color(0.f), throughput(1.f);
+		Ray3f current = ray;
+		HitInfo hit;
+		bool hitSomething = hitp != nullptr;
+		if (hitp)
+			hit = *hitp;
+
+		for (;; ++depth)
 		{
-			Color3f emit = hit.mat->emitted(ray, hit);
+			if (!hitSomething)
+				return color + throughput * scene.background();
+
+			Color3f emit = hit.mat->emitted(current, hit);
 			ScatterRecord srec;
-			bool f=hit.mat->sample(ray.d, hit, srec);
+			bool f=hit.mat->sample(current.d, hit, srec, sampler);
 			if (f&&depth < MaxDepth)
 			{
-				auto eval_val=hit.mat->eval(ray.d, srec.scattered, hit);
-				auto pdf_val=hit.mat->pdf(ray.d, srec.scattered, hit);
-				return this->Li(scene, Ray3f(hit.p,srec.scattered), depth + 1)
-					* eval_val / pdf_val;
+				auto eval_val=hit.mat->eval(current.d, srec.scattered, hit);
+				auto pdf_val=hit.mat->pdf(current.d, srec.scattered, hit);
+				throughput *= eval_val / pdf_val;
+				current = Ray3f(hit.p, srec.scattered);
 			}
 			else
 			{
+				color += throughput * emit;
 				Ray3f scattered;
 				Vec3f attenuation;
-				if (depth < MaxDepth && hit.mat->scatter(ray, hit, attenuation, scattered)) {
-					return emit + attenuation * this->Li(scene,scattered, depth + 1);
+				if (depth < MaxDepth && hit.mat->scatter(current, hit, attenuation, scattered, sampler)) {
+					throughput *= attenuation;
+					current = scattered;
 				}
-				else return emit;
-			}	
+				else return color;
+			}
+
+			if (depth >= RouletteDepth && !russianRoulette(throughput, sampler))
+				return color;
+			hitSomething = scene.intersect(current, hit);
 		}
-		else return scene.background();
 	}
 };
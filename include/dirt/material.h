@@ -20,6 +20,7 @@
 
 #include <dirt/fwd.h>
 #include <dirt/parser.h>
+#include <dirt/sampler.h>
 #include <stdlib.h>
 
 //MetalĲʣûкʵpdfʹṹΪflag
@@ -67,9 +68,10 @@ public:
 	   \param  hit              the ray's intersection with the surface
 	   \param  attenuation      how much the light should be attenuated
 	   \param  scattered        the direction light should be scattered
+	   \param  sampler          source of random numbers for this path
 	   \return bool             True if the surface scatters light
 	 */
-	virtual bool scatter(const Ray3f &ray, const HitInfo &hit, Color3f &attenuation, Ray3f &scattered) const
+	virtual bool scatter(const Ray3f &ray, const HitInfo &hit, Color3f &attenuation, Ray3f &scattered, Sampler &sampler) const
 	{
 		return false;
 	}
@@ -105,7 +107,7 @@ public:
 		return 0.0f;
 	}
 	//һ⣬õһⷽ
-	virtual bool sample(const Vec3f& dirIn, const HitInfo& hit, ScatterRecord& srec)const
+	virtual bool sample(const Vec3f& dirIn, const HitInfo& hit, ScatterRecord& srec, Sampler& sampler)const
 	{
 		return false;
 	}
@@ -118,10 +120,10 @@ class Lambertian : public Material
 public:
 	Lambertian(const json & j = json::object());
 
-	bool scatter(const Ray3f &ray, const HitInfo &hit, Color3f &attenuation, Ray3f &scattered) const override;
+	bool scatter(const Ray3f &ray, const HitInfo &hit, Color3f &attenuation, Ray3f &scattered, Sampler &sampler) const override;
 	Color3f eval(const Vec3f& dirIn, const Vec3f& scattered, const HitInfo& hit)const override;
 	float pdf(const Vec3f& dirIn, const Vec3f& scattered, const HitInfo& hit)const override;
-	bool sample(const Vec3f& dirIn, const HitInfo& hit, ScatterRecord& srec)const override;
+	bool sample(const Vec3f& dirIn, const HitInfo& hit, ScatterRecord& srec, Sampler& sampler)const override;
 	shared_ptr<const Texture> albedo ;     ///= Texture(0.8f)< The diffuse color (fraction of light that is reflected per color channel).
 };
 
@@ -129,7 +131,7 @@ class BlendMaterial :public Material {
 public:
 	BlendMaterial(const json& j = json::object());
 	shared_ptr<const Material>a, b;
-	bool scatter(const Ray3f& ray, const HitInfo& hit, Color3f& attenuation, Ray3f& scattered) const override;
+	bool scatter(const Ray3f& ray, const HitInfo& hit, Color3f& attenuation, Ray3f& scattered, Sampler& sampler) const override;
 	float amount;
 };
 /// A metallic material that reflects light into the (potentially rough) mirror reflection direction.
@@ -138,7 +140,7 @@ class Metal : public Material
 public:
 	Metal(const json & j = json::object());
 
-	bool scatter(const Ray3f &ray, const HitInfo &hit, Color3f &attenuation, Ray3f &scattered) const override;
+	bool scatter(const Ray3f &ray, const HitInfo &hit, Color3f &attenuation, Ray3f &scattered, Sampler &sampler) const override;
 
 
 	shared_ptr<const Texture> albedo;    ///< The reflective color (fraction of light that is reflected per color channel).
@@ -153,7 +155,7 @@ class Dielectric : public Material
 public:
 	Dielectric(const json & j = json::object());
 
-	bool scatter(const Ray3f &ray, const HitInfo &hit, Color3f &attenuation, Ray3f &scattered) const override;
+	bool scatter(const Ray3f &ray, const HitInfo &hit, Color3f &attenuation, Ray3f &scattered, Sampler &sampler) const override;
 
 
 	float ior;      ///< The (relative) index of refraction of the material
@@ -179,7 +181,7 @@ class Phong : public Material
 	public:
 		float pdf(const Vec3f& dirIn, const Vec3f& scattered, const HitInfo& hit) const;
 		Color3f eval(const Vec3f& dirIn, const Vec3f& scattered, const HitInfo& hit)const;
-		bool sample(const Vec3f& dirIn, const HitInfo& hit, ScatterRecord& srec)const;
+		bool sample(const Vec3f& dirIn, const HitInfo& hit, ScatterRecord& srec, Sampler& sampler)const;
 		Phong(const json& j = json::object());
 		shared_ptr<const Texture> albedo;
 		float exponent;
@@ -25,6 +25,7 @@
 #pragma once
 
 #include <dirt/surface.h>
+#include <dirt/bbh.h>
 
 /**
     A triangle mesh.
@@ -40,6 +41,13 @@ public:
 
 	bool empty() const {return F.empty() || V.empty();}
 
+    /// Return the memory used by the vertex and face arrays, in bytes
+    size_t memoryUsage() const
+    {
+        return V.size() * sizeof(Vec3f) + N.size() * sizeof(Vec3f) +
+               UV.size() * sizeof(Vec2f) + F.size() * sizeof(Vec3i);
+    }
+
     vector<Vec3f> V;                        ///< Vertex positions
     vector<Vec3f> N;                        ///< Vertex normals
     vector<Vec2f> UV;                       ///< Vertex texture coordinates
@@ -50,6 +58,30 @@ public:
 };
 
 
+/// ray - single triangle intersection test, computing only the hit distance and barycentrics
+bool singleTriangleIntersect(const Ray3f& ray,
+                             const Vec3f& v0, const Vec3f& v1, const Vec3f& v2,
+                             float& t, float& u, float& v);
+
+/// ray - single triangle intersection routine
+bool singleTriangleIntersect(const Ray3f& ray,
+                             const Vec3f& v0, const Vec3f& v1, const Vec3f& v2,
+                             const Vec3f* n0, const Vec3f* n1, const Vec3f* n2,
+                             const Vec2f* uv0, const Vec2f* uv1, const Vec2f* uv2,
+                             HitInfo& isect,
+                             const Material * material = nullptr,
+                             const SurfaceBase * surface = nullptr);
+
+/// fill in the shading data of a triangle hit at distance \a t with barycentrics \a u, \a v
+void triangleSurfaceInteraction(const Ray3f& ray, float t, float u, float v,
+                                const Vec3f& v0, const Vec3f& v1, const Vec3f& v2,
+                                const Vec3f* n0, const Vec3f* n1, const Vec3f* n2,
+                                const Vec2f* uv0, const Vec2f* uv1, const Vec2f* uv2,
+                                HitInfo& isect,
+                                const Material * material,
+                                const SurfaceBase * surface);
+
+
 /// An instance of a triangle for a given face in a mesh
 class Triangle : public SurfaceBase
 {
@@ -57,7 +89,11 @@ public:
 	Triangle(const Scene & scene, const json & j, shared_ptr<const Mesh> mesh, uint32_t triNumber);
 	Box3f localBBox() const override;
 	Box3f worldBBox() const override;
-	bool intersect(const Ray3f &ray, HitInfo &hit) const override;
+	using SurfaceBase::closestHit;
+	using SurfaceBase::occluded;
+	bool closestHit(const Ray3f &ray, HitInfo &hit) const override;
+	void computeSurfaceInteraction(const Ray3f &ray, HitInfo &hit) const override;
+	bool occluded(const Ray3f &ray) const override;
 
     bool isEmissive() const override {return m_mesh && m_mesh->material && m_mesh->material->isEmissive();}
 
@@ -70,11 +106,101 @@ protected:
 };
 
 
-/// ray - single triangle intersection routine
-bool singleTriangleIntersect(const Ray3f& ray,
-                             const Vec3f& v0, const Vec3f& v1, const Vec3f& v2,
-                             const Vec3f* n0, const Vec3f* n1, const Vec3f* n2,
-                             HitInfo& isect,
-                             const Material * material = nullptr,
-                             const SurfaceBase * surface = nullptr);
+/**
+    A triangle in the layout used by the Moller-Trumbore test.
+
+    Stores the first vertex, both edges leaving it and their (unnormalized)
+    cross product, so a test needs no index lookups and a single cross
+    product.
+ */
+struct PrecomputedTriangle
+{
+    Vec3f v0;                               ///< First vertex
+    Vec3f e1;                               ///< v1 - v0
+    Vec3f e2;                               ///< v2 - v0
+    Vec3f n;                                ///< cross(e1, e2)
+
+    PrecomputedTriangle() = default;
+    PrecomputedTriangle(const Vec3f & p0, const Vec3f & p1, const Vec3f & p2) :
+        v0(p0), e1(p1 - p0), e2(p2 - p0), n(cross(e1, e2))
+    {
+
+    }
+
+    /// Compute the hit distance \a t and barycentrics \a u, \a v of \a ray within [mint, maxt]
+    bool intersect(const Ray3f & ray, float & t, float & u, float & v) const;
+};
+
+
+/**
+    A whole triangle mesh as a single surface.
+
+    Instead of one Triangle object per face, the triangles are stored as
+    face indices into the shared Mesh, in the leaf order of a LinearBBH
+    built over them, so each triangle costs only 4 bytes on top of the
+    mesh data and its share of the tree. The BBH is configured with the
+    (optional) "accelerator" field of the mesh's JSON.
+
+    The "triangles" field of the accelerator selects how triangles are
+    tested:
+
+    - "indexed":     fetch the vertices through the mesh's face indices
+                     (the default)
+    - "precomputed": additionally store a PrecomputedTriangle per face in
+                     leaf order, trading 48 bytes per triangle for fewer
+                     cache misses and flops per test
+ */
+class TriangleMesh : public SurfaceBase
+{
+public:
+    TriangleMesh(const Scene & scene, const json & j, shared_ptr<const Mesh> mesh);
+
+    /**
+        Create a mesh surface from a tree that was built before (e.g. read
+        from a mesh cache), together with the face indices in its leaf
+        order and the local bounds of the mesh.
+     */
+    TriangleMesh(const json & j, shared_ptr<const Mesh> mesh, vector<uint32_t> faces,
+                 LinearBBH tree, const Box3f & localBBox);
+
+    Box3f localBBox() const override {return m_localBBox;}
+    Box3f worldBBox() const override {return m_tree.bounds();}
+    bool closestHit(const Ray3f &ray, HitInfo &hit) const override;
+    bool closestHit(const RayQuery3f &query, HitInfo &hit) const override;
+    uint32_t closestHit(RayPacket &packet, uint32_t mask, HitInfo hits[]) const override;
+    void computeSurfaceInteraction(const Ray3f &ray, HitInfo &hit) const override;
+    bool occluded(const Ray3f &ray) const override;
+    bool occluded(const RayQuery3f &query) const override;
+    uint32_t occluded(const RayPacket &packet, uint32_t mask) const override;
+
+    bool isEmissive() const override {return m_mesh->material && m_mesh->material->isEmissive();}
+
+    const Mesh & mesh() const {return *m_mesh;}
+    const vector<uint32_t> & faces() const {return m_faces;}
+    const LinearBBH & tree() const {return m_tree;}
+
+protected:
+    /// Set up the triangle layout selected by the "triangles" field of \a accelerator
+    void setupTriangles(const json & accelerator);
+
+    // convenience function to access the i-th vertex (i must be 0, 1, or 2) of a face
+    const Vec3f & vertex(uint32_t face, size_t i) const {return m_mesh->V[m_mesh->F[face][i]];}
+
+    /// Intersect \a ray with the i-th triangle in leaf order
+    bool triangleHit(uint32_t i, const Ray3f & ray, float & t, float & u, float & v) const
+    {
+        if (!m_precomputed.empty())
+            return m_precomputed[i].intersect(ray, t, u, v);
+
+        uint32_t f = m_faces[i];
+        return singleTriangleIntersect(ray, vertex(f, 0), vertex(f, 1), vertex(f, 2), t, u, v);
+    }
+
+    shared_ptr<const Mesh> m_mesh;
+    vector<uint32_t> m_faces;               ///< Face indices in the leaf order of m_tree
+    vector<PrecomputedTriangle> m_precomputed; ///< Triangles in leaf order, if precomputed
+    LinearBBH m_tree;
+    Box3f m_localBBox;
+};
+
 
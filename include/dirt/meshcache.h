@@ -0,0 +1,43 @@
+/*
+    This file is part of Dirt, the Dartmouth introductory ray tracer.
+
+    Copyright (c) 2017-2019 by Wojciech Jarosz
+
+    Dirt is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Dirt is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <dirt/mesh.h>
+
+/**
+    Load the Wavefront OBJ file \a filename as a TriangleMesh, through a
+    binary cache.
+
+    Parsing a large OBJ file and building the BBH over its triangles can
+    take much longer than rendering a preview of it. So once a mesh is
+    loaded, its vertex and face arrays and its flattened tree are written
+    to "<filename>.<key>.dirtcache" next to the OBJ file, and subsequent runs
+    map that file into memory instead. The key is a hash of the transform and
+    the tree's parameters, so differently transformed copies of one OBJ file
+    (e.g. a "mesh" and the prototype of its "instance"s) are cached side by side.
+
+    The cache is rebuilt whenever the OBJ file's size or modification time,
+    the mesh's "transform", the tree's build parameters, or the cache format
+    version change. Setting "cache" to false in the mesh's JSON bypasses it.
+
+    \return The mesh surface with its material set, or nullptr if the mesh
+            is empty
+ */
+shared_ptr<TriangleMesh> loadTriangleMesh(const Scene & scene, const json & j,
+                                          const string & filename, const Transform & xform);
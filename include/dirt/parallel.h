@@ -0,0 +1,50 @@
+/*
+    This file is part of Dirt, the Dartmouth introductory ray tracer.
+
+    Copyright (c) 2017-2019 by Wojciech Jarosz
+
+    Dirt is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Dirt is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <dirt/common.h>
+#include <future>
+#include <thread>
+
+/// Number of threads to use when \a requested (0: one per hardware core) are asked for
+inline int numWorkerThreads(int requested = 0)
+{
+    return requested > 0 ? requested : std::max(1, int(std::thread::hardware_concurrency()));
+}
+
+/**
+    Call f(chunk, from, to) for \a numChunks contiguous chunks of [begin, end) in parallel.
+
+    The first chunk runs on the calling thread. Returns once all chunks are
+    done; an exception thrown by any of them is rethrown.
+ */
+template <typename F>
+void parallelChunks(size_t begin, size_t end, int numChunks, F && f)
+{
+    size_t size = end - begin;
+    vector<std::future<void>> tasks;
+    for (int c = 1; c < numChunks; ++c)
+        tasks.push_back(std::async(std::launch::async, [&f, c, begin, size, numChunks]()
+        {
+            f(c, begin + size * c / numChunks, begin + size * (c + 1) / numChunks);
+        }));
+    f(0, begin, begin + size / numChunks);
+    for (auto & task : tasks)
+        task.get();
+}
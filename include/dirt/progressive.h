@@ -0,0 +1,67 @@
+/*
+    This file is part of Dirt, the Dartmouth introductory ray tracer.
+
+    Copyright (c) 2017-2019 by Wojciech Jarosz
+
+    Dirt is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Dirt is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <dirt/scene.h>
+
+/**
+    Renders an image in passes of samples over the whole image.
+
+    Each pass adds the next few samples to every pixel, so the image after
+    any pass is a complete, if noisy, render that can be saved as a
+    checkpoint. The accumulated pixel statistics and sample count can also
+    be saved and loaded again, to continue an interrupted render in a later
+    run. Because sample i of a pixel always draws the same random numbers,
+    a resumed render ends up with exactly the image of an uninterrupted one.
+ */
+class ProgressiveRender
+{
+public:
+    explicit ProgressiveRender(const Scene & scene);
+
+    /// Trace the next \a samples samples of every pixel, without exceeding the scene's limit
+    void renderPass(int samples);
+
+    /// Return whether every pixel has received all of its samples
+    bool finished() const {return m_samplesDone >= m_scene.maxSamples();}
+
+    /// Return the number of samples per pixel traced so far (converged pixels may have fewer)
+    int samplesDone() const {return m_samplesDone;}
+
+    /// Return the image rendered so far
+    Image3f image() const;
+
+    /// Save the accumulated pixel statistics to \a filename, replacing it atomically
+    void save(const string & filename) const;
+
+    /**
+        Continue from the pixel statistics saved to \a filename by \ref save().
+
+        Throws a DirtException if they were rendered from a different scene
+        description, seed or resolution. The sample limits ("image_samples"
+        and the adaptive "max_spp") may differ, so a finished render can be
+        taken to more samples.
+     */
+    void load(const string & filename);
+
+private:
+    const Scene & m_scene;
+    Array2d<PixelStatistics> m_pixels;
+    int m_samplesDone = 0;
+};
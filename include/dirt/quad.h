@@ -31,11 +31,18 @@ public:
     Quad(const Scene & scene, const json & j = json::object());
 
     Box3f localBBox() const override;
-    bool intersect(const Ray3f &ray, HitInfo &hit) const override;
+    using SurfaceBase::closestHit;
+    using SurfaceBase::occluded;
+    bool closestHit(const Ray3f &ray, HitInfo &hit) const override;
+    void computeSurfaceInteraction(const Ray3f &ray, HitInfo &hit) const override;
+    bool occluded(const Ray3f &ray) const override;
     bool isEmissive() const override {return m_material && m_material->isEmissive();}
 
 
 protected:
+    /// Find the hit distance \a t and point \a p of an object-space ray
+    bool localHit(const Ray3f &tray, float &t, Vec3f &p) const;
+
     Vec2f m_size = Vec2f(1.f);
     shared_ptr<const Material> m_material;
 };
\ No newline at end of file
@@ -0,0 +1,120 @@
+/*
+    This file is part of Dirt, the Dartmouth introductory ray tracer.
+
+    Copyright (c) 2017-2019 by Wojciech Jarosz
+
+    Dirt is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Dirt is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <dirt/common.h>
+#include <dirt/stats.h>
+
+/**
+    Source of random numbers while rendering.
+
+    A sampler owns a pcg32 generator that is repositioned at the start of
+    every pixel sample. The stream is chosen by the pixel and the starting
+    state by the scene seed and sample index, so the numbers consumed by one
+    sample never depend on which thread renders it or on what that thread
+    rendered before. This makes renders bit-reproducible at any thread count.
+
+    Each render thread should own its own Sampler.
+ */
+class Sampler
+{
+public:
+    /// Create a sampler for a render using the given global \a seed
+    explicit Sampler(uint64_t seed = 0) : m_seed(seed) {}
+
+    /// Reposition the generator at the start of sample \a index of \a pixel
+    void startPixelSample(const Vec2i & pixel, int index)
+    {
+        uint64_t stream = (uint64_t(uint32_t(pixel.y)) << 32) | uint32_t(pixel.x);
+        m_rng.seed(mix(m_seed ^ mix(uint64_t(index))), stream);
+    }
+
+    /// Return a uniformly distributed float in [0,1)
+    float next1D() {return m_rng.nextFloat();}
+
+    /// Return a uniformly distributed point in [0,1)^2
+    Vec2f next2D()
+    {
+        float a = next1D();
+        float b = next1D();
+        return Vec2f(a, b);
+    }
+
+private:
+    /// SplitMix64 finalizer, scrambles nearby seeds into unrelated states
+    static uint64_t mix(uint64_t z)
+    {
+        z += 0x9e3779b97f4a7c15ULL;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    uint64_t m_seed;
+    pcg32 m_rng;
+};
+
+/**
+    Randomly terminate a path whose \a throughput has become small.
+
+    The path survives with probability min(max(throughput), 0.95), in which
+    case \a throughput is divided by that probability so the estimate stays
+    unbiased. Capping the probability below one also ends paths that lose
+    no energy, such as paths bouncing between glass surfaces.
+
+    \return True if the path should be continued
+ */
+inline bool russianRoulette(Color3f & throughput, Sampler & sampler)
+{
+    float survival = std::min(std::max(throughput.x, std::max(throughput.y, throughput.z)), 0.95f);
+    if (sampler.next1D() >= survival)
+    {
+        DIRT_STAT(RouletteTerminations);
+        return false;
+    }
+    throughput /= survival;
+    return true;
+}
+
+
+inline Vec2f randomInUnitDisk(Sampler & sampler)
+{
+	Vec2f p;
+	do
+	{
+		p = 2.0f * sampler.next2D() - Vec2f(1);
+	} while (length2(p) >= 1.f);
+
+	return p;
+}
+
+
+inline Vec3f randomInUnitSphere(Sampler & sampler)
+{
+	Vec3f p;
+	do
+	{
+        float a = sampler.next1D();
+        float b = sampler.next1D();
+        float c = sampler.next1D();
+		p = 2.0f * Vec3f(a, b, c) - Vec3f(1);
+	} while (length2(p) >= 1.0f);
+
+	return p;
+}
@@ -25,8 +25,40 @@
 #include <dirt/material.h>
 #include<dirt/texture.h>
 #include <dirt/surfacegroup.h>
+#include <dirt/stats.h>
 
 class Integrator;
+class TriangleMesh;
+
+/**
+    Running mean and variance of the samples of one pixel.
+
+    Samples are added with Welford's algorithm, which stays accurate over
+    many samples without storing them. The variance is tracked for the
+    samples' luminance, which is what adaptive sampling needs to decide
+    whether a pixel has converged.
+ */
+struct PixelStatistics
+{
+    Color3f mean = Color3f(0.f);        ///< Mean of the samples so far
+    float m2 = 0.f;                     ///< Sum of squared deviations of the samples' luminance from its mean
+    int count = 0;                      ///< Number of samples so far
+
+    /// Add the color \a sample
+    void add(const Color3f & sample)
+    {
+        float oldMean = luminance(mean);
+        ++count;
+        mean += (sample - mean) / float(count);
+        m2 += (luminance(sample) - oldMean) * (luminance(sample) - luminance(mean));
+    }
+
+    /// Unbiased estimate of the variance of the samples' luminance
+    float variance() const {return count > 1 ? m2 / float(count - 1) : 0.f;}
+
+    /// Estimated standard error of the mean luminance
+    float standardError() const {return count > 1 ? std::sqrt(variance() / float(count)) : 0.f;}
+};
 
 /**
     Main scene data structure.
@@ -56,9 +88,40 @@ public:
             m_emitters.addChild(surface);
     }
 
-    bool intersect(const Ray3f & ray, HitInfo & hit) const override
+    bool closestHit(const Ray3f & ray, HitInfo & hit) const override
+    {
+        DIRT_RAY_STAT_ADD(Rays, 1);
+        return m_surfaces->closestHit(ray, hit);
+    }
+
+    bool closestHit(const RayQuery3f & query, HitInfo & hit) const override
+    {
+        DIRT_RAY_STAT_ADD(Rays, 1);
+        return m_surfaces->closestHit(query, hit);
+    }
+
+    bool occluded(const Ray3f & ray) const override
+    {
+        DIRT_RAY_STAT_ADD(ShadowRays, 1);
+        return m_surfaces->occluded(ray);
+    }
+
+    bool occluded(const RayQuery3f & query) const override
+    {
+        DIRT_RAY_STAT_ADD(ShadowRays, 1);
+        return m_surfaces->occluded(query);
+    }
+
+    uint32_t closestHit(RayPacket & packet, uint32_t mask, HitInfo hits[]) const override
+    {
+        DIRT_RAY_STAT_MASK(Rays, mask);
+        return m_surfaces->closestHit(packet, mask, hits);
+    }
+
+    uint32_t occluded(const RayPacket & packet, uint32_t mask) const override
     {
-        return m_surfaces->intersect(ray, hit);
+        DIRT_RAY_STAT_MASK(ShadowRays, mask);
+        return m_surfaces->occluded(packet, mask);
     }
 
     Box3f localBBox() const override {return m_surfaces->localBBox();}
@@ -74,33 +137,102 @@ public:
      */
     shared_ptr<const Material> findOrCreateMaterial(const json & j, const string & key = "material") const;
 
+    /**
+        Find/load the prototype mesh of an instance.
+
+        Return the mesh in the OBJ file \a filename, in its own object space.
+        Meshes are loaded only once for all instances in the scene that share
+        the same file and "accelerator" parameters in \a j.
+     */
+    shared_ptr<const TriangleMesh> findOrLoadPrototype(const json & j, const string & filename) const;
+
     /// Return a const reference to the emitters
     const SurfaceBase & emitters() const {return m_emitters;}
 
     /// Return the background color
     Color3f background() const {return m_background;}
 
+    /// Return the camera, or nullptr if the scene has none
+    shared_ptr<const Camera> camera() const {return m_camera;}
+
     /**
         Sample the color along a ray
 
-        \param ray  The ray in question
-        \return     An estimate of the color from this direction
+        The path is followed iteratively, one bounce at a time, and ended by
+        Russian roulette once it has bounced "roulette_depth" times (5 by
+        default; a large value such as 64 disables it).
+
+        \param ray      The ray in question
+        \param sampler  Source of random numbers for this path
+        \param depth    Number of bounces the path has already taken
+        \return         An estimate of the color from this direction
      */
-    Color3f recursiveColor(const Ray3f &ray, int depth) const;
+    Color3f recursiveColor(const Ray3f &ray, Sampler &sampler, int depth) const;
+
+    /// Sample the color along a ray whose closest hit (nullptr if none) is already known
+    Color3f recursiveColor(const Ray3f &ray, const HitInfo * hit, Sampler &sampler, int depth) const;
 
     /// Generate the entire image by ray tracing.
     Image3f raytrace() const;
 
+    /**
+        Trace samples [\a firstSample, \a lastSample) of every pixel.
+
+        The samples are added to the pixel's entry in \a pixels, which must
+        have the camera's resolution. With adaptive sampling, pixels that
+        have converged are skipped. Sample i of a pixel always uses the same
+        random numbers, so the samples of an image can be traced in several
+        calls without changing the result.
+     */
+    void renderSamples(Array2d<PixelStatistics> & pixels, int firstSample, int lastSample) const;
+
+    /// Return the maximum number of samples per pixel
+    int maxSamples() const;
+
+    /// Return whether adaptive sampling may stop sampling the pixel with the statistics \a pixel
+    bool converged(const PixelStatistics & pixel) const;
+
+    /// Return the global seed of all random number streams
+    uint64_t seed() const {return m_seed;}
+
+    /**
+        Return a hash of the JSON scene description.
+
+        Leaves out the settings that do not change any individual sample:
+        "threads", "image_samples" and the adaptive "max_spp".
+     */
+    uint64_t descriptionHash() const {return m_descriptionHash;}
+
+    /**
+        Set the number of threads used by \ref raytrace().
+
+        A value of 0 (the default) uses one thread per hardware core.
+     */
+    void setNumThreads(int numThreads) {m_numThreads = numThreads;}
+
 
 private:
     shared_ptr<Camera> m_camera;
     map<string, shared_ptr<const Material>> m_materials;
+    mutable map<string, shared_ptr<const TriangleMesh>> m_prototypes; ///< instance meshes by file and accelerator
     shared_ptr<SurfaceGroup> m_surfaces;
     SurfaceGroup m_emitters {*this};
     Color3f m_background = Color3f(0.2f);
     shared_ptr<Integrator> m_integrator;
 
     int m_imageSamples = 1;                      ///< samples per pixels in each direction
+    int m_numThreads = 0;                        ///< render threads (0 = hardware concurrency)
+
+    ///\{ \name Adaptive sampling, enabled by an "adaptive" object in the scene
+    bool m_adaptive = false;
+    int m_minSamples = 16;                       ///< samples every pixel gets ("min_spp")
+    int m_maxSamples = 0;                        ///< sample limit per pixel ("max_spp", 0 = image_samples)
+    float m_threshold = 0.01f;                   ///< largest relative standard error of a converged pixel
+    ///\}
+
+    uint64_t m_seed = 0;                         ///< global seed for all random number streams
+    int m_rouletteDepth = 5;                     ///< bounces before Russian roulette may end a path without an integrator
+    uint64_t m_descriptionHash = 0;              ///< see descriptionHash()
 };
 
 // create test scenes that do not need to be loaded from a file
@@ -30,11 +30,18 @@ public:
     Sphere(const Scene & scene, const json & j = json::object());
 
     Box3f localBBox() const override;
-    bool intersect(const Ray3f &ray, HitInfo &hit) const override;
+    using SurfaceBase::closestHit;
+    using SurfaceBase::occluded;
+    bool closestHit(const Ray3f &ray, HitInfo &hit) const override;
+    void computeSurfaceInteraction(const Ray3f &ray, HitInfo &hit) const override;
+    bool occluded(const Ray3f &ray) const override;
     bool isEmissive() const override {return m_material && m_material->isEmissive();}
 
 
 protected:
+    /// Find the nearest hit distance \a t of an object-space ray within [mint, maxt]
+    bool localHit(const Ray3f &tray, float &t) const;
+
     float m_radius = 1.0f;
     shared_ptr<const Material> m_material;
 };
\ No newline at end of file
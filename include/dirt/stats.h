@@ -0,0 +1,169 @@
+/*
+    This file is part of Dirt, the Dartmouth introductory ray tracer.
+
+    Copyright (c) 2017-2019 by Wojciech Jarosz
+
+    Dirt is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Dirt is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <dirt/common.h>
+#include <dirt/timer.h>
+#include <bitset>
+#include <vector>
+
+/**
+    Compile-time switch for the detailed rendering statistics.
+
+    Counting BBH nodes, box tests and primitive tests costs a memory
+    increment in the innermost traversal and intersection loops, so by
+    default these are only compiled into debug builds. Define DIRT_STATS to
+    1 or 0 to override this. Rays are counted in every build, as that costs
+    next to nothing per ray.
+ */
+#ifndef DIRT_STATS
+#ifdef NDEBUG
+#define DIRT_STATS 0
+#else
+#define DIRT_STATS 1
+#endif
+#endif
+
+/// The events counted while rendering
+enum class Stat : int
+{
+    CameraRays,                         ///< Rays generated by the camera
+    Rays,                               ///< Closest-hit queries against the scene (camera rays included)
+    ShadowRays,                         ///< Occlusion queries against the scene
+    NodesVisited,                       ///< BBH nodes whose children (or primitives) were considered
+    BoxTests,                           ///< Ray-box tests during BBH traversal
+    PrimitiveTests,                     ///< Ray-primitive intersection tests
+    RouletteTerminations,               ///< Paths ended by Russian roulette
+    Count
+};
+
+/// Return a human-readable name of \a stat
+const char * statName(Stat stat);
+
+/// A set of counters, one per Stat
+struct StatCounters
+{
+    uint64_t counts[int(Stat::Count)] = {};
+
+    uint64_t operator[](Stat stat) const {return counts[int(stat)];}
+    uint64_t & operator[](Stat stat) {return counts[int(stat)];}
+
+    StatCounters & operator+=(const StatCounters & other)
+    {
+        for (int i = 0; i < int(Stat::Count); ++i)
+            counts[i] += other.counts[i];
+        return *this;
+    }
+};
+
+/**
+    The counters of the calling thread.
+
+    Every thread counts into its own array without any synchronization;
+    \ref flushThreadStats() adds them to the global totals. This is a plain
+    array so accessing it never goes through a thread-local init wrapper.
+ */
+extern thread_local uint64_t g_threadStats[int(Stat::Count)];
+
+/// Add the calling thread's counters to the global totals and reset them
+void flushThreadStats();
+
+/// Return the global totals, after flushing the calling thread's counters
+StatCounters statTotals();
+
+/// Reset the global totals, the calling thread's counters, and all timings and memory use
+void resetStats();
+
+/// Count \a n \a stat events (a Stat enumerator) on the calling thread, in every build
+#define DIRT_RAY_STAT_ADD(stat, n) (g_threadStats[int(Stat::stat)] += uint64_t(n))
+
+/// Count one \a stat event for each ray selected by the packet mask \a mask, in every build
+#define DIRT_RAY_STAT_MASK(stat, mask) DIRT_RAY_STAT_ADD(stat, std::bitset<32>(mask).count())
+
+#if DIRT_STATS
+#define DIRT_STAT_ADD(stat, n) DIRT_RAY_STAT_ADD(stat, n)
+#else
+#define DIRT_STAT_ADD(stat, n) ((void)0)
+#endif
+
+/// Count one \a stat event (a Stat enumerator) on the calling thread
+#define DIRT_STAT(stat) DIRT_STAT_ADD(stat, 1)
+
+/// Count one \a stat event for each ray selected by the packet mask \a mask
+#define DIRT_STAT_MASK(stat, mask) DIRT_STAT_ADD(stat, std::bitset<32>(mask).count())
+
+
+/// The phases of a run whose wall-clock time is reported
+enum class Phase : int
+{
+    Parse,                              ///< Parsing the scene, including loading meshes and building trees
+    MeshLoad,                           ///< Parsing OBJ files or reading mesh caches
+    BBHBuild,                           ///< Building BBHs
+    Render,                             ///< Scene::raytrace()
+    Count
+};
+
+/// Return a human-readable name of \a phase
+const char * phaseName(Phase phase);
+
+/// Add \a ms milliseconds to the time spent in \a phase
+void addPhaseTime(Phase phase, double ms);
+
+/// Adds the lifetime of a scope to the time spent in a Phase
+class PhaseTimer
+{
+public:
+    explicit PhaseTimer(Phase phase) : m_phase(phase) {}
+    ~PhaseTimer() {addPhaseTime(m_phase, m_timer.elapsed());}
+
+    /// Return the number of milliseconds elapsed so far
+    double elapsed() const {return m_timer.elapsed();}
+
+private:
+    Phase m_phase;
+    Timer m_timer;
+};
+
+/// The kinds of memory whose use is reported
+enum class MemoryCategory : int
+{
+    Meshes,                             ///< Vertex and face arrays of triangle meshes
+    BBH,                                ///< Nodes of BBHs
+    Count
+};
+
+/// Return a human-readable name of \a category
+const char * memoryCategoryName(MemoryCategory category);
+
+/// Record that \a bytes of memory were allocated for \a category
+void addMemoryUsage(MemoryCategory category, size_t bytes);
+
+/**
+    Record the busy time of each render thread during one frame.
+
+    \param busy   Milliseconds each thread spent rendering tiles
+    \param wall   Milliseconds the whole frame took
+ */
+void addRenderThreadTimes(const std::vector<double> & busy, double wall);
+
+/// Print a report of all statistics gathered so far
+void printStatsReport();
+
+/// Write all statistics gathered so far to the JSON file \a filename
+void writeStatsReport(const std::string & filename);
@@ -30,6 +30,12 @@
     value. Includes the position, traveled ray distance, uv coordinates, the
     geometric and interpolated shading normals, and a pointer to the intersected
     surface and underlying material.
+
+    The record is filled in two steps. SurfaceBase::closestHit() only sets
+    \ref t, \ref surface and, for surfaces that need them, primitive-local
+    coordinates in \ref uv (e.g. the barycentric coordinates of a triangle
+    hit). SurfaceBase::computeSurfaceInteraction() later fills in the
+    remaining shading data once for the final, closest hit.
  */
 struct HitInfo
 {
@@ -37,9 +43,10 @@ struct HitInfo
 	Vec3f p;                                ///< Hit position
 	Vec3f gn;                               ///< Geometric normal
 	Vec3f sn;                               ///< Interpolated shading normal
-	Vec2f uv;                               ///< UV texture coordinates
+	Vec2f uv;                               ///< UV texture coordinates (local hit coordinates before computeSurfaceInteraction())
 	const Material * mat = nullptr;         ///< Material at the hit point
 	const SurfaceBase * surface = nullptr;  ///< Surface at the hit point
+	uint32_t primitive = 0;                 ///< Primitive of \ref surface that was hit (e.g. a mesh face)
 
 	/// Default constructor that leaves all members uninitialized
 	HitInfo() = default;
@@ -102,7 +109,8 @@ public:
         Ray-Surface intersection test.
 
         Intersect a ray against this surface and return detailed intersection
-        information.
+        information. This finds the closest hit with \ref closestHit() and
+        then computes its shading data with \ref computeSurfaceInteraction().
         
         \param ray
              A 3-dimensional ray data structure with minimum/maximum
@@ -112,7 +120,123 @@ public:
              intersection query
         \return  \c true if an intersection was found
      */
-    virtual bool intersect(const Ray3f &ray, HitInfo &hit) const = 0;
+    bool intersect(const Ray3f &ray, HitInfo &hit) const
+    {
+        if (!closestHit(ray, hit))
+            return false;
+
+        hit.surface->computeSurfaceInteraction(ray, hit);
+        return true;
+    }
+
+    /**
+        Find the closest hit along a ray without computing shading data.
+
+        On success, implementations set only hit.t, hit.surface and whatever
+        primitive-local coordinates their \ref computeSurfaceInteraction()
+        needs. \a hit must be left untouched if nothing is hit, so aggregates
+        can test candidates one after the other against a single record.
+
+        \return  \c true if an intersection was found
+     */
+    virtual bool closestHit(const Ray3f &ray, HitInfo &hit) const = 0;
+
+    /**
+        \ref closestHit() for a ray already prepared for traversal.
+
+        Aggregates override this to reuse the query's precomputed inverse
+        direction; the base class implementation falls back to
+        \ref closestHit() on query.ray.
+     */
+    virtual bool closestHit(const RayQuery3f &query, HitInfo &hit) const
+    {
+        return closestHit(query.ray, hit);
+    }
+
+    /**
+        \ref closestHit() for the rays of \a packet selected by \a mask.
+
+        For each selected ray k that hits, hits[k] is filled as by
+        \ref closestHit() and the ray's maxt shrinks to the hit distance.
+        Accelerators override this to share node fetches across the packet;
+        the base class implementation traces the rays one at a time.
+
+        \return  the mask of the rays that hit
+     */
+    virtual uint32_t closestHit(RayPacket &packet, uint32_t mask, HitInfo hits[]) const
+    {
+        uint32_t hitMask = 0;
+        for (int k = 0; k < packet.size; ++k)
+        {
+            if ((mask & (1u << k)) && closestHit(packet.queries[k], hits[k]))
+            {
+                hitMask |= 1u << k;
+                packet.queries[k].ray.maxt = hits[k].t;
+            }
+        }
+        return hitMask;
+    }
+
+    /**
+        Intersect all rays of \a packet and compute the shading data of
+        their hits, like \ref intersect() does for a single ray.
+
+        \return  the mask of the rays that hit
+     */
+    uint32_t intersect(RayPacket &packet, HitInfo hits[]) const
+    {
+        uint32_t hitMask = closestHit(packet, packet.mask(), hits);
+        for (int k = 0; k < packet.size; ++k)
+            if (hitMask & (1u << k))
+                hits[k].surface->computeSurfaceInteraction(packet.queries[k].ray, hits[k]);
+        return hitMask;
+    }
+
+    /**
+        Fill in the position, normals, uv coordinates and material of a hit.
+
+        Called once for the final hit returned by \ref closestHit() on the
+        surface stored in hit.surface, with the same \a ray.
+
+        The base class implementation does nothing.
+     */
+    virtual void computeSurfaceInteraction(const Ray3f &ray, HitInfo &hit) const {}
+
+    /**
+        Ray-Surface occlusion (any-hit) test.
+
+        Return whether the ray hits this surface anywhere within its
+        [mint, maxt] segment. Unlike \ref intersect(), implementations may
+        stop at the first hit they find and compute no shading information,
+        which makes this the query of choice for visibility/shadow rays.
+
+        The base class implementation simply falls back to \ref closestHit().
+     */
+    virtual bool occluded(const Ray3f &ray) const
+    {
+        HitInfo hit;
+        return closestHit(ray, hit);
+    }
+
+    /// \ref occluded() for a ray already prepared for traversal (see \ref closestHit())
+    virtual bool occluded(const RayQuery3f &query) const
+    {
+        return occluded(query.ray);
+    }
+
+    /**
+        \ref occluded() for the rays of \a packet selected by \a mask.
+
+        \return  the mask of the selected rays that are occluded
+     */
+    virtual uint32_t occluded(const RayPacket &packet, uint32_t mask) const
+    {
+        uint32_t occludedMask = 0;
+        for (int k = 0; k < packet.size; ++k)
+            if ((mask & (1u << k)) && occluded(packet.queries[k]))
+                occludedMask |= 1u << k;
+        return occludedMask;
+    }
 
 
     /// Return whether or not this Surface's Material is emissive.
@@ -131,7 +255,8 @@ public:
 class Surface : public SurfaceBase
 {
 public:
-	Surface(const Transform & xform = Transform()) : m_xform(xform) {}
+	Surface(const Transform & xform = Transform()) :
+        m_xform(xform), m_toWorld(xform), m_toLocal(xform.inverse()) {}
 
     Surface(const Scene & scene, const json & j = json::object());
     virtual ~Surface() {}
@@ -146,4 +271,6 @@ public:
 
 protected:
     Transform m_xform = Transform();        ///< Local-to-world Transformation
+    FastTransform m_toWorld;                ///< m_xform, for the hot paths
+    FastTransform m_toLocal;                ///< The inverse of m_xform, for the hot paths
 };
\ No newline at end of file
@@ -52,16 +52,24 @@ public:
     virtual void clear();
 
     void addChild(shared_ptr<SurfaceBase> surface) override;
+
+    using SurfaceBase::closestHit;
+    using SurfaceBase::occluded;
  
     /**
         Intersect a ray against all surfaces registered with the Accelerator.
 
-        Detailed information about the intersection, if any, will be stored
-        in the provided \ref hit data record.
+        The closest hit, if any, will be stored in the provided \ref hit data
+        record.
 
         \return true If an intersection was found
     */
-    bool intersect(const Ray3f &ray, HitInfo &hit) const override;
+    bool closestHit(const Ray3f &ray, HitInfo &hit) const override;
+    bool closestHit(const RayQuery3f &query, HitInfo &hit) const override;
+
+    /// Return whether the ray hits any surface registered with the Accelerator
+    bool occluded(const Ray3f &ray) const override;
+    bool occluded(const RayQuery3f &query) const override;
 
 
 protected:
@@ -170,3 +170,120 @@ struct Transform
                                 {o, 1}));
     }
 };
+
+
+/**
+    A Transform prepared for being applied many times.
+
+    Transform always goes through the full 4x4 homogeneous math. This class
+    instead classifies the matrix once and stores only what the cheapest
+    applicable case needs:
+
+    - Identity:     nothing to do
+    - Translation:  one addition
+    - UniformScale: a scalar multiplication plus a translation
+    - Affine:       a 3x3 matrix (and its inverse transpose for normals)
+                    plus a translation, without the homogeneous divide
+    - Projective:   anything else, handled by the full Transform
+ */
+struct FastTransform
+{
+    enum class Type
+    {
+        Identity,
+        Translation,
+        UniformScale,
+        Affine,
+        Projective
+    };
+
+    Type type = Type::Identity;
+    Vec3f rows[3];                          ///< Rows of the 3x3 part (Affine)
+    Vec3f normalRows[3];                    ///< Rows of its inverse transpose (Affine)
+    Vec3f offset = Vec3f(0.f);              ///< Translation
+    float scale = 1.f;                      ///< Scale factor (UniformScale)
+    float invScale = 1.f;                   ///< Inverse scale factor (UniformScale)
+    Transform full;                         ///< The transform itself (Projective)
+
+    FastTransform() = default;
+
+    /// Pick the cheapest representation of \a xform
+    explicit FastTransform(const Transform & xform) : full(xform)
+    {
+        // the computed inverse of an affine matrix can pick up roundoff in its
+        // last row, so tolerate that instead of falling back to the full math
+        const float eps = 1e-6f;
+        const Mat44f & m = xform.m;
+        if (std::abs(m(3, 0)) > eps || std::abs(m(3, 1)) > eps || std::abs(m(3, 2)) > eps ||
+            std::abs(m(3, 3) - 1.f) > eps)
+        {
+            type = Type::Projective;
+            return;
+        }
+
+        offset = Vec3f(m(0, 3), m(1, 3), m(2, 3));
+        for (int i = 0; i < 3; ++i)
+        {
+            rows[i] = Vec3f(m(i, 0), m(i, 1), m(i, 2));
+            normalRows[i] = Vec3f(xform.mInv(0, i), xform.mInv(1, i), xform.mInv(2, i));
+        }
+
+        bool diagonal = m(0, 1) == 0.f && m(0, 2) == 0.f && m(1, 0) == 0.f &&
+                        m(1, 2) == 0.f && m(2, 0) == 0.f && m(2, 1) == 0.f;
+        if (diagonal && m(0, 0) == m(1, 1) && m(0, 0) == m(2, 2) && m(0, 0) != 0.f)
+        {
+            scale = m(0, 0);
+            invScale = 1.f / scale;
+            bool translated = offset.x != 0.f || offset.y != 0.f || offset.z != 0.f;
+            type = scale != 1.f ? Type::UniformScale :
+                   translated   ? Type::Translation : Type::Identity;
+        }
+        else
+            type = Type::Affine;
+    }
+
+    /// Apply the transformation to a 3D point
+    Vec3f point(const Vec3f &p) const
+    {
+        switch (type)
+        {
+            case Type::Identity:     return p;
+            case Type::Translation:  return p + offset;
+            case Type::UniformScale: return p * scale + offset;
+            case Type::Affine:       return Vec3f(dot(rows[0], p), dot(rows[1], p), dot(rows[2], p)) + offset;
+            default:                 return full.point(p);
+        }
+    }
+
+    /// Apply the transformation to a 3D vector
+    Vec3f vector(const Vec3f &v) const
+    {
+        switch (type)
+        {
+            case Type::Identity:
+            case Type::Translation:  return v;
+            case Type::UniformScale: return v * scale;
+            case Type::Affine:       return Vec3f(dot(rows[0], v), dot(rows[1], v), dot(rows[2], v));
+            default:                 return full.vector(v);
+        }
+    }
+
+    /// Apply the transformation to a 3D normal
+    Vec3f normal(const Vec3f &n) const
+    {
+        switch (type)
+        {
+            case Type::Identity:
+            case Type::Translation:  return n;
+            case Type::UniformScale: return n * invScale;
+            case Type::Affine:       return Vec3f(dot(normalRows[0], n), dot(normalRows[1], n), dot(normalRows[2], n));
+            default:                 return full.normal(n);
+        }
+    }
+
+    /// Apply the transformation to a ray (keeping its mint and maxt)
+    Ray3f ray(const Ray3f &r) const
+    {
+        return Ray3f(point(r.o), vector(r.d), r.mint, r.maxt);
+    }
+};
@@ -0,0 +1,53 @@
+/*
+    This file is part of Dirt, the Dartmouth introductory ray tracer.
+
+    Copyright (c) 2017-2019 by Wojciech Jarosz
+
+    Dirt is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Dirt is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <dirt/integrator.h>
+
+/**
+    A path tracer that advances a whole batch of paths one bounce at a time.
+
+    Instead of following each path recursively to its end, the paths of a
+    batch are kept in queues and pushed through the same stages for every
+    bounce: all active paths are intersected with the scene in packets, then
+    sorted by the material they hit and shaded, and the paths that continue
+    are compacted to the front of the queue for the next bounce. This keeps
+    the code and data for one stage hot while it runs over many paths.
+
+    It computes exactly the same estimate as PathTracerMaterials: each path
+    draws from its own sampler, in the same order as the recursive tracer.
+ */
+class WavefrontPathTracer : public Integrator
+{
+public:
+    WavefrontPathTracer(const json & j);
+
+    Color3f shade(const Scene & scene, Sampler & sampler, const Ray3f & ray, const HitInfo * hit,
+                  int depth = 0) const override;
+    void shadeBatch(const Scene & scene, int count, Sampler samplers[], const Ray3f rays[],
+                    const HitInfo * const hits[], Color3f colors[]) const override;
+
+private:
+    /// Trace the batch of paths, whose first vertices are at bounce \a depth
+    void trace(const Scene & scene, int count, Sampler samplers[], const Ray3f rays[],
+               const HitInfo * const hits[], Color3f colors[], int depth) const;
+
+    int m_maxBounces;
+    int m_rouletteDepth;                ///< Bounces before Russian roulette may terminate a path
+};
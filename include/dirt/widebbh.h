@@ -0,0 +1,128 @@
+/*
+    This file is part of Dirt, the Dartmouth introductory ray tracer.
+
+    Copyright (c) 2017-2019 by Wojciech Jarosz
+
+    Dirt is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Dirt is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <dirt/common.h>
+#include <dirt/box.h>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define DIRT_SSE 1
+#endif
+#if defined(__AVX__)
+#define DIRT_AVX 1
+#endif
+
+#if defined(DIRT_SSE) || defined(DIRT_AVX)
+#include <immintrin.h>
+#endif
+
+/**
+    A node of a wide (4- or 8-ary) BBH.
+
+    The child boxes are stored in structure-of-arrays layout, so the slab
+    test of one ray against all \a N children is a handful of SIMD
+    operations. Unused child slots get an inverted (empty) box, which no
+    ray ever hits.
+ */
+template <int N>
+struct alignas(N * sizeof(float)) WideBBHNode
+{
+    float bounds[2][3][N];              ///< [min/max][axis][child] child bounds
+    uint32_t offset[N];                 ///< Interior child: node index, leaf child: first primitive
+    uint16_t count[N];                  ///< Number of primitives of a leaf child (0 otherwise)
+
+    bool isLeaf(int i) const {return count[i] > 0;}
+
+    /// Set the bounds of child \a i (an empty box marks an unused slot)
+    void setBounds(int i, const Box3f & box)
+    {
+        for (int a = 0; a < 3; ++a)
+        {
+            bounds[0][a][i] = box.pMin[a];
+            bounds[1][a][i] = box.pMax[a];
+        }
+    }
+};
+
+/**
+    Slab test of \a query against all children of \a node.
+
+    \return a bit mask with bit i set if child i is hit within
+            [mint, maxt] of the query's ray; the entry distance of each hit child is
+            written to \a tNear.
+ */
+template <int N>
+inline int intersectChildren(const WideBBHNode<N> & node, const RayQuery3f & query,
+                             float tNear[N])
+{
+    // portable fallback, written so compilers can vectorize it
+    int mask = 0;
+    for (int i = 0; i < N; ++i)
+    {
+        float tmin = query.ray.mint, tmax = query.ray.maxt;
+        for (int a = 0; a < 3; ++a)
+        {
+            float t0 = node.bounds[query.sign[a]][a][i] * query.invD[a] + query.negOInvD[a];
+            float t1 = node.bounds[1 - query.sign[a]][a][i] * query.invD[a] + query.negOInvD[a];
+            tmin = t0 > tmin ? t0 : tmin;
+            tmax = t1 < tmax ? t1 : tmax;
+        }
+        tNear[i] = tmin;
+        mask |= int(tmin <= tmax) << i;
+    }
+    return mask;
+}
+
+#if defined(DIRT_SSE)
+template <>
+inline int intersectChildren<4>(const WideBBHNode<4> & node, const RayQuery3f & query,
+                                float tNear[4])
+{
+    __m128 tmin = _mm_set1_ps(query.ray.mint), tmax = _mm_set1_ps(query.ray.maxt);
+    for (int a = 0; a < 3; ++a)
+    {
+        __m128 invD = _mm_set1_ps(query.invD[a]), offset = _mm_set1_ps(query.negOInvD[a]);
+        __m128 t0 = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(node.bounds[query.sign[a]][a]), invD), offset);
+        __m128 t1 = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(node.bounds[1 - query.sign[a]][a]), invD), offset);
+        tmin = _mm_max_ps(t0, tmin);
+        tmax = _mm_min_ps(t1, tmax);
+    }
+    _mm_storeu_ps(tNear, tmin);
+    return _mm_movemask_ps(_mm_cmple_ps(tmin, tmax));
+}
+#endif
+
+#if defined(DIRT_AVX)
+template <>
+inline int intersectChildren<8>(const WideBBHNode<8> & node, const RayQuery3f & query,
+                                float tNear[8])
+{
+    __m256 tmin = _mm256_set1_ps(query.ray.mint), tmax = _mm256_set1_ps(query.ray.maxt);
+    for (int a = 0; a < 3; ++a)
+    {
+        __m256 invD = _mm256_set1_ps(query.invD[a]), offset = _mm256_set1_ps(query.negOInvD[a]);
+        __m256 t0 = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(node.bounds[query.sign[a]][a]), invD), offset);
+        __m256 t1 = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(node.bounds[1 - query.sign[a]][a]), invD), offset);
+        tmin = _mm256_max_ps(t0, tmin);
+        tmax = _mm256_min_ps(t1, tmax);
+    }
+    _mm256_storeu_ps(tNear, tmin);
+    return _mm256_movemask_ps(_mm256_cmp_ps(tmin, tmax, _CMP_LE_OQ));
+}
+#endif
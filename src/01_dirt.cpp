@@ -18,8 +18,62 @@
 
 #include <dirt/scene.h>
 #include <dirt/argparse.h>
+#include <dirt/stats.h>
 #include <time.h>  
 #include <filesystem/resolver.h>
+#include <dirt/progressive.h>
+#include <dirt/timer.h>
+
+/**
+    Render \a scene in passes, saving the image to \a outFiles and the render
+    state next to the first of them at checkpoints and at the end.
+ */
+Image3f renderProgressive(const Scene & scene, const json & args, const vector<string> & outFiles)
+{
+    int passSamples = args["progressive"].empty() ? 1 : args["progressive"].get<int>();
+    if (passSamples < 1)
+        throw DirtException("The number of samples per progressive pass must be at least 1.");
+    double checkpointSeconds = args["checkpoint_seconds"].get<double>();
+    int checkpointPasses = args["checkpoint_passes"].get<int>();
+    string stateFile = outFiles[0].substr(0, outFiles[0].find_last_of('.')) + ".dirtstate";
+
+    ProgressiveRender render(scene);
+    if (!args["resume"].empty())
+    {
+        render.load(args["resume"].get<string>());
+        message("Resuming render at %d samples per pixel.\n", render.samplesDone());
+    }
+
+    auto checkpoint = [&]()
+    {
+        auto image = render.image();
+        for (const auto & file : outFiles)
+            if (!image.save(file))
+                warning("Could not save checkpoint image \"%s\".\n", file);
+        render.save(stateFile);
+        message("Saved checkpoint at %d samples per pixel to \"%s\".\n", render.samplesDone(), stateFile);
+    };
+
+    Timer timer;
+    int passes = 0;
+    while (!render.finished())
+    {
+        render.renderPass(passSamples);
+        ++passes;
+        if ((checkpointPasses > 0 && passes >= checkpointPasses) ||
+            (checkpointSeconds > 0.0 && timer.elapsed() >= 1000.0 * checkpointSeconds))
+        {
+            if (!render.finished())
+                checkpoint();
+            passes = 0;
+            timer.reset();
+        }
+    }
+
+    // keep the final state, so the render can later be continued to more samples
+    render.save(stateFile);
+    return render.image();
+}
 
 // runs the raytrace over all tests and saves the corresponding images
 int main(int argc, char** argv)
@@ -33,7 +87,13 @@ int main(int argc, char** argv)
                                    {"help", "h",  "Display this help screen and quit", typeid(bool), true, json()},
 	                               {"outfile", "o",  "Specify the output image filename (extension must be one of: .png, .jpg, .hdr, .bmp, or .tga)", typeid(string), true, json()},
                                    {"format", "f",  "Specify just the output image format (png, jpg, hdr, bmp, or tga)", typeid(string), true, "png"},
-                                   {"verbosity", "v",  "Specify the level of verbosity [0,1,2,3, or 4]", typeid(int), true, 3}
+                                   {"verbosity", "v",  "Specify the level of verbosity [0,1,2,3, or 4]", typeid(int), true, 3},
+                                   {"threads", "t",  "Specify the number of render threads (overrides the scene's \"threads\"; 0 uses all cores)", typeid(int), true, json()},
+                                   {"stats", "",  "Also write the statistics report as JSON to this file", typeid(string), true, json()},
+                                   {"progressive", "p",  "Render progressively, in passes of this many samples per pixel", typeid(int), true, json()},
+                                   {"checkpoint_seconds", "",  "When rendering progressively, save the image and render state after passes at least this many seconds apart (0 = never)", typeid(double), true, 60.0},
+                                   {"checkpoint_passes", "",  "When rendering progressively, save the image and render state after this many passes (0 = never)", typeid(int), true, 0},
+                                   {"resume", "r",  "Continue the render from this render state file (implies --progressive)", typeid(string), true, json()}
                                },
                                {
                                    {"scene.json", "",  "The filename of the JSON scenefile to load (or the string \"testsceneX\", where X is 0, 1, 2, or 3).", typeid(string), false, json("")},
@@ -92,10 +152,23 @@ int main(int argc, char** argv)
 
         message("Will save rendered image to \"%s\"\n", outFile);
 
-        auto image = scene->raytrace();
+        if (!args["threads"].empty())
+            scene->setNumThreads(args["threads"].get<int>());
+
+        Image3f image;
+        if (args["progressive"].empty() && args["resume"].empty())
+            image = scene->raytrace();
+        else
+        {
+            vector<string> outFiles = {outFile};
+            if (!outFileHdr.empty())
+                outFiles.push_back(outFileHdr);
+            image = renderProgressive(*scene, args, outFiles);
+        }
 
-        message("Average number of intersection tests per ray: %f \n",
-                float(intersection_tests) / float(rays_traced));
+        printStatsReport();
+        if (!args["stats"].empty())
+            writeStatsReport(args["stats"].get<string>());
         message("Writing rendered image to file \"%s\"...\n", outFile);
 
         image.save(outFile);
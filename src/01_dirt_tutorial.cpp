@@ -24,11 +24,12 @@
 #include<dirt/quad.h>
 #include <dirt/surfacegroup.h>
 #include <dirt/progress.h>
+#include <dirt/stats.h>
 
 Color3f vec2color(const Vec3f & dir);
 Color3f rayToColor(const Ray3f & r);
 Color3f intersectionToColor(const Ray3f & r, const Sphere & sphere);
-Color3f recursiveColor(const Ray3f &ray, const SurfaceGroup &scene, int depth);
+Color3f recursiveColor(const Ray3f &ray, const SurfaceGroup &scene, Sampler &sampler, int depth);
 void functionWithJSONParameters(const json & j);
 void testColorAndImage();
 void testVectorsAndMatrices();
@@ -519,7 +520,8 @@ void testMaterials()
 	Ray3f lambertScattered;
 	Color3f lambertAttenuation;
 	message("Testing lambert scatter\n");
-	if (lambertMaterial.scatter(ray, hit, lambertAttenuation, lambertScattered))
+	Sampler sampler;
+	if (lambertMaterial.scatter(ray, hit, lambertAttenuation, lambertScattered, sampler))
 	{
 		Vec3f correctOrigin = surfacePoint;
 		Color3f correctAttenuation = surfaceColor;
@@ -549,7 +551,7 @@ void testMaterials()
     Ray3f metalScattered;
 	Color3f metalAttenuation;
 	message("Testing metal scatter\n");
-	if (metalMaterial.scatter(ray, hit, metalAttenuation, metalScattered))
+	if (metalMaterial.scatter(ray, hit, metalAttenuation, metalScattered, sampler))
 	{
 		Vec3f correctOrigin = surfacePoint;
 		Color3f correctAttenuation = surfaceColor;
@@ -619,6 +621,7 @@ void testRecursiveRaytracing()
 
     // To raytrace more than one object at a time, we can put them into a group
 	SurfaceGroup scene;
+	Sampler sampler;
 
 	scene.addChild(dielectricSphere);
 	scene.addChild(shinySphere);
@@ -631,7 +634,7 @@ void testRecursiveRaytracing()
 		{
 			for (auto x : range(rayImage.width()))
 			{
-				INCREMENT_TRACED_RAYS;
+				DIRT_STAT(CameraRays);
 				auto ray = camera.generateRay(x + 0.5f, y + 0.5f);
 				Color3f color = Color3f(0.0f);
 
@@ -639,7 +642,8 @@ void testRecursiveRaytracing()
 				// results. Assign the average color to ``color''
 				for (auto i = 0; i < NumSamples; i++)
 				{
-					color+=recursiveColor(ray, scene, 0);
+					sampler.startPixelSample(Vec2i(x, y), i);
+					color+=recursiveColor(ray, scene, sampler, 0);
 				}
 				color /= NumSamples;
 				rayImage(x, y) = color;
@@ -649,14 +653,16 @@ void testRecursiveRaytracing()
 	}	// progress reporter goes out of scope here
 
 
-    message("Average number of intersection tests per ray: %f \n", float(intersection_tests) / float(rays_traced));
+    auto stats = statTotals();
+    message("Average number of intersection tests per ray: %f \n",
+            float(stats[Stat::PrimitiveTests]) / float(stats[Stat::CameraRays]));
 
 	string filename("D:/workspace/dirt_basecode/scenes/01_raytrace/01_recursive_raytracing.png");
 	message("Saving rendered image to %s....\n", filename);
 	rayImage.save(filename);
 }
 
-Color3f recursiveColor(const Ray3f &ray, const SurfaceGroup &scene, int depth)
+Color3f recursiveColor(const Ray3f &ray, const SurfaceGroup &scene, Sampler &sampler, int depth)
 {
 	const int MaxDepth = 64;
 
@@ -677,8 +683,8 @@ Color3f recursiveColor(const Ray3f &ray, const SurfaceGroup &scene, int depth)
 		Ray3f scattered;
 		Vec3f attenuation;
 		//const Ray3f& ray, const HitInfo& hit, Color3f& attenuation, Ray3f& scattered
-		if (depth < MaxDepth && hit.mat->scatter(ray, hit, attenuation, scattered)) {
-			return attenuation * recursiveColor(scattered, scene, depth + 1);
+		if (depth < MaxDepth && hit.mat->scatter(ray, hit, attenuation, scattered, sampler)) {
+			return attenuation * recursiveColor(scattered, scene, sampler, depth + 1);
 		}
 		else return Color3f(0.f);
 	}
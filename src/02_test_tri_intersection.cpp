@@ -47,7 +47,7 @@ int main(int argc, char** argv)
    const Ray3f testRay(Vec3f(1.0f, -1.0f, -5.0f), Vec3f(0.0f, 0.20f, 0.50f));
    HitInfo hit;
 
-   if (singleTriangleIntersect(testRay, v0, v1, v2, &n0, &n1, &n2, hit))
+   if (singleTriangleIntersect(testRay, v0, v1, v2, &n0, &n1, &n2, nullptr, nullptr, nullptr, hit))
    {
        float correctT = 12.520326f;
        Vec3f correctP(1.0f, 1.504065f, 1.260162f);
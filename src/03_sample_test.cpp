@@ -137,10 +137,11 @@ void SampleTester::runTest(shared_ptr<Material> mat, Vec3f normal, std::string n
     bool isSpecularSet = false;
     bool belowHemisphere = false;
     bool nanOrInf = false;
+    Sampler sampler;
     for (int i = 0; i < NumSamples; ++i) {
         // Sample material
         ScatterRecord record;
-        if (!mat->sample(dirIn, hit, record))
+        if (!mat->sample(dirIn, hit, record, sampler))
             continue;
 
         if (record.isSpecular)
@@ -17,96 +17,601 @@
 */
 
 #include <dirt/bbh.h>
+#include <dirt/binaryfile.h>
+#include <dirt/parallel.h>
+#include <algorithm>
 
-BBHNode::BBHNode(vector<shared_ptr<SurfaceBase>> primitives, Progress & progress)
+namespace
 {
-    if (primitives.size() == 1)
+
+// Past this depth we fall back to median splits, which bounds the depth of
+// the tree (and thus the traversal stack) even for pathological inputs.
+const int MaxSAHDepth = 64;
+
+// Cost of traversing a node relative to intersecting a primitive
+const float TraversalCost = 0.125f;
+
+// Subtrees with fewer primitives are built on a single thread
+const size_t MinParallelSubtree = 4 * 1024;
+
+// Nodes with fewer primitives are binned and partitioned on a single thread
+const size_t MinParallelPartition = 64 * 1024;
+
+} // namespace
+
+
+LinearBBH::LinearBBH(const json & j)
+{
+    string type = j.value("type", string("bbh"));
+    if (type == "qbvh")
+        m_width = 4;
+    else if (type == "obvh")
+        m_width = 8;
+    else if (type != "bbh" && type != "bvh")
+        throw DirtException("Unknown BBH type '%s' here:\n%s.", type, j.dump(4));
+
+    string split = j.value("split", string("sah"));
+    if (split == "sah")
+        m_splitMethod = SplitMethod::SAH;
+    else if (split == "median")
+        m_splitMethod = SplitMethod::Median;
+    else if (split == "random")
+        m_splitMethod = SplitMethod::Random;
+    else
+        throw DirtException("Unknown BBH 'split' method '%s' here:\n%s.", split, j.dump(4));
+
+    m_numBins = j.value("bins", m_numBins);
+    if (m_numBins < 2)
+        throw DirtException("BBH 'bins' must be at least 2 here:\n%s.", j.dump(4));
+
+    m_maxLeafSize = j.value("max_leaf_size", m_maxLeafSize);
+    if (m_maxLeafSize < 1 || m_maxLeafSize > 255)
+        throw DirtException("BBH 'max_leaf_size' must be between 1 and 255 here:\n%s.", j.dump(4));
+
+    m_buildThreads = j.value("build_threads", m_buildThreads);
+    if (m_buildThreads < 0)
+        throw DirtException("BBH 'build_threads' must not be negative here:\n%s.", j.dump(4));
+}
+
+
+vector<uint32_t> LinearBBH::build(const vector<Box3f> & bounds)
+{
+    PhaseTimer timer(Phase::BBHBuild);
+    Progress progress("Building BVH", bounds.size());
+    m_nodes.clear();
+    m_wideNodes4.clear();
+    m_wideNodes8.clear();
+    m_bounds = Box3f();
+    if (bounds.empty())
+        return {};
+
+    // compute the centroid of each primitive once up front
+    vector<BuildPrimitive> primitives(bounds.size());
+    for (auto i : range(bounds.size()))
     {
-        m_left = m_right = primitives[0];
-        progress += 1;
+        primitives[i].bounds = bounds[i];
+        primitives[i].centroid = bounds[i].center();
+        primitives[i].index = uint32_t(i);
     }
-    else if (primitives.size() == 2)
+
+    m_nodes.reserve(2 * primitives.size() - 1);
+    buildRecursive(m_nodes, primitives, 0, primitives.size(), 0, numWorkerThreads(m_buildThreads), progress);
+    m_nodes.shrink_to_fit();
+    m_bounds = m_nodes[0].bounds;
+
+    // collapse into a wide tree, after which the binary one is no longer needed
+    if (m_width == 4)
+        collapse(m_wideNodes4, 0);
+    else if (m_width == 8)
+        collapse(m_wideNodes8, 0);
+    if (m_width != 2)
+        vector<LinearBBHNode>().swap(m_nodes);
+
+    debug("BBH: %d-wide tree (%s) over %d primitives.\n", m_width,
+          memString(memoryUsage()), primitives.size());
+
+    vector<uint32_t> order(primitives.size());
+    for (auto i : range(primitives.size()))
+        order[i] = primitives[i].index;
+    return order;
+}
+
+/**
+    Recursively build the subtree over primitives [start,end), appending its
+    nodes to \a nodes in depth-first order. Returns the index of its root.
+
+    Up to \a numThreads threads may be used. They are first used to bin and
+    partition large nodes, and then to build the two subtrees of a node
+    concurrently into separate arrays, which are appended to \a nodes
+    afterwards. Every step is deterministic and independent of how the
+    work is split up, so the tree is identical to a single-threaded build.
+ */
+uint32_t LinearBBH::buildRecursive(vector<LinearBBHNode> & nodes,
+                                   vector<BuildPrimitive> & primitives,
+                                   size_t start, size_t end, int depth,
+                                   int numThreads, Progress & progress) const
+{
+    uint32_t nodeIndex = uint32_t(nodes.size());
+    nodes.emplace_back();
+
+    size_t count = end - start;
+    int chunks = count >= MinParallelPartition ? numThreads : 1;
+    vector<Box3f> chunkBounds(chunks);
+    parallelChunks(start, end, chunks, [&](int c, size_t from, size_t to)
     {
-        m_left = primitives[0];
-        m_right = primitives[1];
-        progress += 2;
+        for (auto i : range(from, to))
+            chunkBounds[c].enclose(primitives[i].bounds);
+    });
+    Box3f bounds;
+    for (auto & b : chunkBounds)
+        bounds.enclose(b);
+
+    size_t mid = start;
+    int axis = 0;
+    bool makeLeaf = count == 1;
+    if (!makeLeaf)
+    {
+        SplitMethod method = depth < MaxSAHDepth ? m_splitMethod : SplitMethod::Median;
+        float cost;
+        mid = partition(primitives, start, end, method, chunks, axis, cost);
+
+        // only accept a leaf when it is small enough, and with the SAH only
+        // when intersecting everything is cheaper than splitting
+        if (count <= size_t(m_maxLeafSize))
+            makeLeaf = method != SplitMethod::SAH ||
+                       count <= TraversalCost + cost / bounds.surfaceArea();
     }
-    else
+
+    LinearBBHNode & node = nodes[nodeIndex];
+    node.bounds = bounds;
+    node.axis = uint8_t(axis);
+    node.pad = 0;
+    if (makeLeaf)
     {
-        int axis = int(randf() * 3.0f);
-        std::sort(primitives.begin(), primitives.end(),
-                  [&](shared_ptr<const SurfaceBase> a, shared_ptr<const SurfaceBase> b) {
-                      return a->worldBBox().center()[axis] <
-                             b->worldBBox().center()[axis];
-                  });
-
-        vector<shared_ptr<SurfaceBase>> leftList, rightList;
-        leftList.insert(leftList.begin(), primitives.begin(),
-                        primitives.begin() + primitives.size() / 2);
-        rightList.insert(rightList.begin(),
-                         primitives.begin() + primitives.size() / 2,
-                         primitives.end());
-
-        m_left = make_shared<BBHNode>(leftList, progress);
-        m_right = make_shared<BBHNode>(rightList, progress);
+        node.primitivesOffset = uint32_t(start);
+        node.numPrimitives = uint16_t(count);
+        progress += count;
+        return nodeIndex;
     }
+    node.numPrimitives = 0;
 
-    (m_bounds = m_left->worldBBox()).enclose(m_right->worldBBox());
-}
+    if (numThreads == 1 || count < MinParallelSubtree)
+    {
+        buildRecursive(nodes, primitives, start, mid, depth + 1, 1, progress);
+        uint32_t secondChild = buildRecursive(nodes, primitives, mid, end, depth + 1, 1, progress);
+        // nodes may have been reallocated by the recursive calls
+        nodes[nodeIndex].secondChildOffset = secondChild;
+        return nodeIndex;
+    }
 
-BBHNode::~BBHNode()
-{
+    // build the first subtree on another thread, and the second one on this one
+    int firstThreads = numThreads / 2;
+    vector<LinearBBHNode> firstNodes, secondNodes;
+    auto first = std::async(std::launch::async, [&]()
+    {
+        buildRecursive(firstNodes, primitives, start, mid, depth + 1, firstThreads, progress);
+    });
+    buildRecursive(secondNodes, primitives, mid, end, depth + 1, numThreads - firstThreads, progress);
+    first.get();
+
+    // splice both subtrees in after this node, fixing up their child offsets
+    auto append = [&nodes](const vector<LinearBBHNode> & subtree)
+    {
+        uint32_t offset = uint32_t(nodes.size());
+        for (auto n : subtree)
+        {
+            if (!n.isLeaf())
+                n.secondChildOffset += offset;
+            nodes.push_back(n);
+        }
+        return offset;
+    };
+    append(firstNodes);
+    nodes[nodeIndex].secondChildOffset = append(secondNodes);
+    return nodeIndex;
 }
 
-bool BBHNode::intersect(const Ray3f &ray, HitInfo &hit) const
+/**
+    Reorder primitives [start,end) into two non-empty groups and return the
+    index where the second group begins.
+
+    Also returns the chosen split \a axis and, for SAH splits, the
+    (unnormalized) SAH \a cost of the split. The SAH binning and partitioning
+    are split into \a chunks pieces that are processed in parallel.
+ */
+size_t LinearBBH::partition(vector<BuildPrimitive> & primitives,
+                            size_t start, size_t end, SplitMethod method,
+                            int chunks, int & axis, float & cost) const
 {
-    if (m_bounds.intersect(ray))
+    vector<Box3f> chunkBounds(chunks);
+    parallelChunks(start, end, chunks, [&](int c, size_t from, size_t to)
+    {
+        for (auto i : range(from, to))
+            chunkBounds[c].enclose(primitives[i].centroid);
+    });
+    Box3f centroidBounds;
+    for (auto & b : chunkBounds)
+        centroidBounds.enclose(b);
+
+    axis = int(maxDim(centroidBounds.diagonal()));
+    if (method == SplitMethod::Random)
+    {
+        // seed from the range so the tree does not depend on build order
+        pcg32 rng(start, end);
+        axis = int(rng.nextUInt(3));
+    }
+
+    size_t mid = (start + end) / 2;
+    float extent = centroidBounds.pMax[axis] - centroidBounds.pMin[axis];
+    cost = std::numeric_limits<float>::infinity();
+
+    // All centroids coincide: any split is as good as another
+    if (!(extent > 0.f))
+        return mid;
+
+    auto centroidLess = [axis](const BuildPrimitive & a, const BuildPrimitive & b)
+    {
+        return a.centroid[axis] < b.centroid[axis];
+    };
+
+    if (method != SplitMethod::SAH)
+    {
+        std::nth_element(&primitives[start], &primitives[mid],
+                         &primitives[end - 1] + 1, centroidLess);
+        return mid;
+    }
+
+    // Binned SAH: project the centroids into equally sized bins along axis
+    struct Bin
     {
-        HitInfo leftHit, rightHit;
-        bool hitLeft = m_left->intersect(ray, leftHit);
-        bool hitRight = m_right->intersect(ray, rightHit);
+        Box3f bounds;
+        size_t count = 0;
+    };
+    float toBin = m_numBins / extent;
+    auto binIndex = [&](const BuildPrimitive & p)
+    {
+        int b = int((p.centroid[axis] - centroidBounds.pMin[axis]) * toBin);
+        return clamp(b, 0, m_numBins - 1);
+    };
 
-        if (hitLeft && hitRight)
+    // each chunk fills its own bins, which are then merged
+    vector<vector<Bin>> chunkBins(chunks, vector<Bin>(m_numBins));
+    parallelChunks(start, end, chunks, [&](int c, size_t from, size_t to)
+    {
+        for (auto i : range(from, to))
         {
-            if (leftHit.t < rightHit.t)
-                hit = leftHit;
-            else
-                hit = rightHit;
-            return true;
+            Bin & bin = chunkBins[c][binIndex(primitives[i])];
+            bin.bounds.enclose(primitives[i].bounds);
+            bin.count++;
         }
-        else if (hitLeft)
+    });
+    vector<Bin> bins(m_numBins);
+    for (auto & cb : chunkBins)
+        for (auto b : range(m_numBins))
         {
-            hit = leftHit;
-            return true;
+            bins[b].bounds.enclose(cb[b].bounds);
+            bins[b].count += cb[b].count;
         }
-        else if (hitRight)
+
+    // sweep from the right to get the cost of everything above each plane
+    vector<float> rightCost(m_numBins);
+    {
+        Box3f bounds;
+        size_t n = 0;
+        for (int b = m_numBins - 1; b > 0; --b)
         {
-            hit = rightHit;
-            return true;
+            bounds.enclose(bins[b].bounds);
+            n += bins[b].count;
+            rightCost[b] = n ? n * bounds.surfaceArea() : 0.f;
         }
-        else
-            return false;
     }
-    else
+
+    // then from the left, picking the plane with the lowest total cost
+    int bestSplit = 1;
+    size_t numLeft = 0;
+    {
+        Box3f bounds;
+        size_t n = 0;
+        for (int b = 1; b < m_numBins; ++b)
+        {
+            bounds.enclose(bins[b - 1].bounds);
+            n += bins[b - 1].count;
+            float c = (n ? n * bounds.surfaceArea() : 0.f) + rightCost[b];
+            if (c < cost)
+            {
+                cost = c;
+                bestSplit = b;
+                numLeft = n;
+            }
+        }
+    }
+
+    // floating point round-off may leave one side empty
+    mid = start + numLeft;
+    if (mid == start || mid == end)
+    {
+        mid = (start + end) / 2;
+        std::nth_element(&primitives[start], &primitives[mid],
+                         &primitives[end - 1] + 1, centroidLess);
+        return mid;
+    }
+
+    // stable partition, so the order within each side does not depend on
+    // the number of chunks: each chunk scatters its primitives to the
+    // positions given by the counts of the chunks before it
+    auto goesLeft = [&](const BuildPrimitive & p) { return binIndex(p) < bestSplit; };
+    if (chunks == 1)
+    {
+        std::stable_partition(&primitives[start], &primitives[end - 1] + 1, goesLeft);
+        return mid;
+    }
+
+    vector<size_t> chunkLeft(chunks + 1, 0);
+    parallelChunks(start, end, chunks, [&](int c, size_t from, size_t to)
+    {
+        for (auto i : range(from, to))
+            chunkLeft[c + 1] += goesLeft(primitives[i]);
+    });
+    for (auto c : range(chunks))
+        chunkLeft[c + 1] += chunkLeft[c];
+
+    vector<BuildPrimitive> partitioned(end - start);
+    parallelChunks(start, end, chunks, [&](int c, size_t from, size_t to)
+    {
+        size_t left = chunkLeft[c];
+        size_t right = numLeft + (from - start) - chunkLeft[c];
+        for (auto i : range(from, to))
+            partitioned[goesLeft(primitives[i]) ? left++ : right++] = primitives[i];
+    });
+    parallelChunks(start, end, chunks, [&](int c, size_t from, size_t to)
+    {
+        std::copy(partitioned.begin() + (from - start), partitioned.begin() + (to - start),
+                  primitives.begin() + from);
+    });
+    return mid;
+}
+
+void LinearBBH::write(BinaryWriter & writer) const
+{
+    // the build parameters, so a reader can tell whether the tree is still valid
+    writer.write(int32_t(m_width));
+    writer.write(int32_t(m_splitMethod));
+    writer.write(int32_t(m_numBins));
+    writer.write(int32_t(m_maxLeafSize));
+
+    writer.write(m_bounds);
+    writer.write(m_nodes);
+    writer.write(m_wideNodes4);
+    writer.write(m_wideNodes8);
+}
+
+bool LinearBBH::read(BinaryReader & reader, size_t numPrimitives)
+{
+    m_nodes.clear();
+    m_wideNodes4.clear();
+    m_wideNodes8.clear();
+    m_bounds = Box3f();
+
+    int width = reader.read<int32_t>();
+    int splitMethod = reader.read<int32_t>();
+    int numBins = reader.read<int32_t>();
+    int maxLeafSize = reader.read<int32_t>();
+    if (width != m_width || splitMethod != int(m_splitMethod) ||
+        numBins != m_numBins || maxLeafSize != m_maxLeafSize)
         return false;
+
+    m_bounds = reader.read<Box3f>();
+    reader.read(m_nodes);
+    reader.read(m_wideNodes4);
+    reader.read(m_wideNodes8);
+    validate(numPrimitives);
+    return true;
 }
 
+void LinearBBH::validate(size_t numPrimitives) const
+{
+    if (m_width == 4)
+        validateWide(m_wideNodes4, numPrimitives);
+    else if (m_width == 8)
+        validateWide(m_wideNodes8, numPrimitives);
+    else
+    {
+        if (m_nodes.empty() != (numPrimitives == 0))
+            throw DirtException("BBH has %d nodes for %d primitives.", m_nodes.size(), numPrimitives);
+
+        // children always follow their parent, which also rules out cycles
+        for (auto i : range(m_nodes.size()))
+        {
+            const LinearBBHNode & node = m_nodes[i];
+            if (node.isLeaf())
+            {
+                if (uint64_t(node.primitivesOffset) + node.numPrimitives > numPrimitives)
+                    throw DirtException("BBH node %d references primitives out of range.", i);
+            }
+            else if (i + 1 >= m_nodes.size() || node.secondChildOffset <= i + 1 ||
+                     node.secondChildOffset >= m_nodes.size() || node.axis > 2)
+                throw DirtException("BBH node %d references children out of range.", i);
+        }
+    }
+}
 
-BBH::BBH(const Scene & scene, const json & j) : SurfaceGroup(scene, j)
+template <int N>
+void LinearBBH::validateWide(const vector<WideBBHNode<N>> & nodes, size_t numPrimitives) const
 {
+    if (nodes.empty() != (numPrimitives == 0))
+        throw DirtException("BBH has %d nodes for %d primitives.", nodes.size(), numPrimitives);
+
+    for (auto i : range(nodes.size()))
+        for (int c = 0; c < N; ++c)
+        {
+            const WideBBHNode<N> & node = nodes[i];
+            if (node.isLeaf(c))
+            {
+                if (uint64_t(node.offset[c]) + node.count[c] > numPrimitives)
+                    throw DirtException("BBH node %d references primitives out of range.", i);
+            }
+            // unused slots point back at the root, but have an empty box no ray can enter
+            else if (node.offset[c] == 0 ? !(node.bounds[0][0][c] > node.bounds[1][0][c])
+                                         : node.offset[c] <= i || node.offset[c] >= nodes.size())
+                throw DirtException("BBH node %d references children out of range.", i);
+        }
 }
 
 
+BBH::BBH(const Scene & scene, const json & j) : SurfaceGroup(scene, j), m_tree(j)
+{
+
+}
+
 void BBH::build()
 {
-    Progress progress("Building BVH", m_surfaces.size());
-    if (!m_surfaces.empty())
-        m_root = make_shared<BBHNode>(m_surfaces, progress);
+    vector<Box3f> bounds(m_surfaces.size());
+    for (auto i : range(m_surfaces.size()))
+        bounds[i] = m_surfaces[i]->worldBBox();
+
+    // store the surfaces in leaf order so each leaf references a contiguous range
+    auto order = m_tree.build(bounds);
+    vector<shared_ptr<SurfaceBase>> ordered(m_surfaces.size());
+    for (auto i : range(order.size()))
+        ordered[i] = m_surfaces[order[i]];
+    m_surfaces.swap(ordered);
+
+    addMemoryUsage(MemoryCategory::BBH, m_tree.memoryUsage());
+}
+
+/**
+    Convert the binary subtree rooted at \a nodeIndex into \a N-wide nodes
+    appended to \a wideNodes, returning the index of its root.
+
+    Each wide node takes in the children of up to N - 1 binary nodes,
+    always opening up the interior child with the largest surface area,
+    since it is the one most likely to be hit.
+ */
+template <int N>
+uint32_t LinearBBH::collapse(vector<WideBBHNode<N>> & wideNodes, uint32_t nodeIndex) const
+{
+    uint32_t children[N];
+    int numChildren = 0;
+    const LinearBBHNode & node = m_nodes[nodeIndex];
+    if (node.isLeaf())
+        // only happens for a root leaf
+        children[numChildren++] = nodeIndex;
     else
-        m_root = nullptr;
+    {
+        children[numChildren++] = nodeIndex + 1;
+        children[numChildren++] = node.secondChildOffset;
+    }
+
+    while (numChildren < N)
+    {
+        int best = -1;
+        float bestArea = -1.f;
+        for (int i = 0; i < numChildren; ++i)
+        {
+            const LinearBBHNode & child = m_nodes[children[i]];
+            if (!child.isLeaf() && child.bounds.surfaceArea() > bestArea)
+            {
+                best = i;
+                bestArea = child.bounds.surfaceArea();
+            }
+        }
+        if (best < 0)
+            break;
+
+        uint32_t opened = children[best];
+        children[best] = opened + 1;
+        children[numChildren++] = m_nodes[opened].secondChildOffset;
+    }
+
+    uint32_t wideIndex = uint32_t(wideNodes.size());
+    wideNodes.emplace_back();
+    for (int i = 0; i < N; ++i)
+    {
+        // wideNodes may be reallocated by the recursive calls
+        if (i >= numChildren)
+        {
+            wideNodes[wideIndex].setBounds(i, Box3f());
+            wideNodes[wideIndex].offset[i] = 0;
+            wideNodes[wideIndex].count[i] = 0;
+            continue;
+        }
+
+        const LinearBBHNode & child = m_nodes[children[i]];
+        uint32_t offset = child.isLeaf() ? child.primitivesOffset
+                                         : collapse(wideNodes, children[i]);
+        wideNodes[wideIndex].setBounds(i, child.bounds);
+        wideNodes[wideIndex].offset[i] = offset;
+        wideNodes[wideIndex].count[i] = child.numPrimitives;
+    }
+    return wideIndex;
+}
+
+bool BBH::closestHit(const RayQuery3f &_query, HitInfo &hit) const
+{
+    // copy the query so we can shrink maxt as closer hits are found
+    RayQuery3f query = _query;
+    bool hitSomething = false;
+
+    m_tree.traverse(query, [&](uint32_t begin, uint32_t end)
+    {
+        for (auto i : range(begin, end))
+        {
+            if (m_surfaces[i]->closestHit(query, hit))
+            {
+                hitSomething = true;
+                query.ray.maxt = hit.t;
+            }
+        }
+        return false;
+    });
+
+    return hitSomething;
+}
+
+bool BBH::occluded(const RayQuery3f &query) const
+{
+    bool hitSomething = false;
+
+    // stop the traversal as soon as any primitive is hit
+    m_tree.traverse(query, [&](uint32_t begin, uint32_t end)
+    {
+        for (auto i : range(begin, end))
+            if (m_surfaces[i]->occluded(query))
+                return hitSomething = true;
+        return false;
+    });
+
+    return hitSomething;
 }
 
-bool BBH::intersect(const Ray3f &ray, HitInfo &hit) const
+uint32_t BBH::closestHit(RayPacket &packet, uint32_t mask, HitInfo hits[]) const
 {
-    return m_root ? m_root->intersect(ray, hit) : false;
+    uint32_t hitMask = 0;
+    m_tree.traverse(packet, mask, [&](uint32_t begin, uint32_t end, uint32_t rays)
+    {
+        for (auto i : range(begin, end))
+            hitMask |= m_surfaces[i]->closestHit(packet, rays, hits);
+        return 0u;
+    });
+
+    return hitMask;
+}
+
+uint32_t BBH::occluded(const RayPacket &packet, uint32_t mask) const
+{
+    uint32_t occludedMask = 0;
+    m_tree.traverse(packet, mask, [&](uint32_t begin, uint32_t end, uint32_t rays)
+    {
+        uint32_t occluded = 0;
+        for (auto i : range(begin, end))
+        {
+            occluded |= m_surfaces[i]->occluded(packet, rays & ~occluded);
+            if (occluded == rays)
+                break;
+        }
+        occludedMask |= occluded;
+        return occluded;
+    });
+
+    return occludedMask;
 }
@@ -0,0 +1,140 @@
+/*
+    This file is part of Dirt, the Dartmouth introductory ray tracer.
+
+    Copyright (c) 2017-2019 by Wojciech Jarosz
+
+    Dirt is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Dirt is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <dirt/binaryfile.h>
+#include <cstdio>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+#if defined(_WIN32)
+
+MemoryMappedFile::MemoryMappedFile(const string & filename)
+{
+    std::ifstream is(filename, std::ios::binary | std::ios::ate);
+    if (is.fail())
+        throw DirtException("Unable to open file '%s'!", filename);
+
+    m_buffer.resize(size_t(is.tellg()));
+    is.seekg(0, is.beg);
+    if (!is.read(m_buffer.data(), m_buffer.size()))
+        throw DirtException("Unable to read file '%s'!", filename);
+
+    m_data = m_buffer.data();
+    m_size = m_buffer.size();
+}
+
+MemoryMappedFile::~MemoryMappedFile()
+{
+
+}
+
+#else
+
+MemoryMappedFile::MemoryMappedFile(const string & filename)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+        throw DirtException("Unable to open file '%s'!", filename);
+
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        close(fd);
+        throw DirtException("Unable to stat file '%s'!", filename);
+    }
+    m_size = size_t(st.st_size);
+
+    // mmap refuses empty mappings, and there is nothing to map anyway
+    if (m_size > 0)
+    {
+        void * data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            close(fd);
+            throw DirtException("Unable to map file '%s' into memory!", filename);
+        }
+        m_data = static_cast<const char *>(data);
+    }
+
+    // the mapping stays valid after the descriptor is closed
+    close(fd);
+}
+
+MemoryMappedFile::~MemoryMappedFile()
+{
+    if (m_data)
+        munmap(const_cast<char *>(m_data), m_size);
+}
+
+#endif
+
+
+BinaryWriter::BinaryWriter(const string & filename) :
+    m_filename(filename), m_os(filename, std::ios::binary | std::ios::trunc)
+{
+    if (m_os.fail())
+        throw DirtException("Unable to create file '%s'!", filename);
+}
+
+void BinaryWriter::close()
+{
+    m_os.close();
+    if (m_os.fail())
+        throw DirtException("Unable to write file '%s'!", m_filename);
+}
+
+void BinaryWriter::writeBytes(const void * data, size_t size)
+{
+    m_os.write(static_cast<const char *>(data), std::streamsize(size));
+    m_offset += size;
+}
+
+void BinaryWriter::align()
+{
+    static const char zeros[Alignment] = {};
+    writeBytes(zeros, (Alignment - m_offset % Alignment) % Alignment);
+}
+
+
+void replaceFile(const string & tempFile, const string & filename)
+{
+    // never remove filename first, which would leave a window in which it does not exist
+#if defined(_WIN32)
+    // rename does not replace existing files on Windows
+    bool replaced = MoveFileExA(tempFile.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    // rename replaces an existing filename atomically
+    bool replaced = std::rename(tempFile.c_str(), filename.c_str()) == 0;
+#endif
+    if (!replaced)
+    {
+        std::remove(tempFile.c_str());
+        throw DirtException("Unable to rename '%s' to '%s'.", tempFile, filename);
+    }
+}
@@ -22,9 +22,6 @@
 #include <iomanip>
 #include <filesystem/resolver.h>
 
-uint64_t intersection_tests = 0;
-uint64_t rays_traced = 0;
-
 Verbosity g_verbosity = Verbosity::Debug;
 
 Verbosity verbosity()
@@ -0,0 +1,221 @@
+/*
+    This file is part of Dirt, the Dartmouth introductory ray tracer.
+
+    Copyright (c) 2017-2019 by Wojciech Jarosz
+
+    Dirt is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Dirt is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <dirt/scene.h>
+#include <dirt/argparse.h>
+#include <dirt/stats.h>
+#include <filesystem/resolver.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+
+/*
+    Measures the speed of the acceleration structures and intersection
+    kernels.
+
+    Each scene is loaded once per accelerator configuration, and the same
+    seeded ray sets are fired at every configuration:
+
+    - primary:    camera rays through random points of the image,
+    - incoherent: rays with random origins in the scene's bounding box and
+                  uniformly random directions,
+    - shadow:     segments from the hit points of the primary rays to
+                  random points in the scene's bounding box.
+
+    Only the closest-hit and occlusion queries are timed, not shading.
+ */
+
+namespace
+{
+
+/// A named set of rays, all closest-hit queries or all occlusion queries
+struct RaySet
+{
+    string name;
+    vector<Ray3f> rays;
+    bool shadow;
+};
+
+/// Split \a list at commas
+vector<string> splitList(const string & list)
+{
+    vector<string> items;
+    std::stringstream stream(list);
+    string item;
+    while (std::getline(stream, item, ','))
+        if (!item.empty())
+            items.push_back(item);
+    return items;
+}
+
+/// Return a uniformly distributed point in \a box
+Vec3f pointInBox(const Box3f & box, pcg32 & rng)
+{
+    Vec3f p;
+    for (int i = 0; i < 3; ++i)
+        p[i] = lerp(box.pMin[i], box.pMax[i], rng.nextFloat());
+    return p;
+}
+
+/// Return a uniformly distributed direction
+Vec3f randomDirection(pcg32 & rng)
+{
+    float z = 1.f - 2.f * rng.nextFloat();
+    float r = std::sqrt(std::max(0.f, 1.f - z * z));
+    float phi = 2.f * M_PI * rng.nextFloat();
+    return Vec3f(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+/// Generate the ray sets for \a scene, with \a count rays each
+vector<RaySet> generateRays(const Scene & scene, int count, uint64_t seed)
+{
+    pcg32 rng(seed);
+    Box3f bounds = scene.localBBox();
+
+    vector<RaySet> sets = {{"primary", {}, false}, {"incoherent", {}, false}, {"shadow", {}, true}};
+    if (auto camera = scene.camera())
+    {
+        Vec2i resolution = camera->resolution();
+        for (int i = 0; i < count; ++i)
+            sets[0].rays.push_back(camera->generateRay(rng.nextFloat() * float(resolution.x),
+                                                       rng.nextFloat() * float(resolution.y)));
+    }
+
+    for (int i = 0; i < count; ++i)
+        sets[1].rays.push_back(Ray3f(pointInBox(bounds, rng), randomDirection(rng)));
+
+    // shadow rays start on the surfaces hit by the primary rays
+    for (size_t i = 0; i < sets[0].rays.size() && int(sets[2].rays.size()) < count; ++i)
+    {
+        HitInfo hit;
+        if (!scene.intersect(sets[0].rays[i], hit))
+            continue;
+        Vec3f target = pointInBox(bounds, rng);
+        sets[2].rays.push_back(Ray3f(hit.p, target - hit.p, Epsilon, 1.f - Epsilon));
+    }
+
+    return sets;
+}
+
+/// The scene description in \a filename, with its accelerator replaced by one of \a type
+json loadSceneDescription(const string & filename, const string & type)
+{
+    std::ifstream stream(filename, std::ifstream::in);
+    if (!stream.good())
+        throw DirtException("Cannot open file: %s.", filename);
+
+    json j;
+    stream >> j;
+    json accelerator = {{"type", type}};
+    j["accelerator"] = accelerator;
+
+    // meshes always build their own BBH; use the benchmarked one for those that do not pick one.
+    // Their trees are built from scratch, without touching the user's mesh caches.
+    if (j.contains("surfaces"))
+        for (auto & surface : j["surfaces"])
+            if (surface.value("type", string()) == "mesh" || surface.value("type", string()) == "instance")
+            {
+                surface["cache"] = false;
+                if (type != "group" && !surface.contains("accelerator"))
+                    surface["accelerator"] = accelerator;
+            }
+    return j;
+}
+
+} // namespace
+
+
+int main(int argc, char** argv)
+{
+    auto cmd = CommandlineParser({
+                               "dirt_bench",
+                               {
+                                   {"help", "h",  "Display this help screen and quit", typeid(bool), true, json()},
+                                   {"accelerators", "a",  "Comma-separated accelerator types to compare (group, bbh, qbvh, obvh)", typeid(string), true, "group,bbh,qbvh,obvh"},
+                                   {"rays", "n",  "Number of rays in each ray set", typeid(int), true, 1 << 20},
+                                   {"seed", "s",  "Seed of the random ray sets", typeid(int), true, 0},
+                                   {"verbosity", "v",  "Specify the level of verbosity [0,1,2,3, or 4]", typeid(int), true, 2}
+                               },
+                               {
+                                   {"scenes", "",  "Comma-separated list of JSON scene files to benchmark", typeid(string), false, json("")},
+                               }
+                           });
+
+    auto args = cmd.parse(argc, argv);
+
+    if (!args["help"].empty())
+        cmd.printUsageAndQuit();
+
+    try
+    {
+        setVerbosity(args["verbosity"].get<int>());
+        int count = args["rays"].get<int>();
+        uint64_t seed = uint64_t(args["seed"].get<int>());
+        auto accelerators = splitList(args["accelerators"].get<string>());
+
+#if !DIRT_STATS
+        message("Built without DIRT_STATS: nodes and primitive tests per ray are not counted.\n");
+#else
+        message("Built with DIRT_STATS: timings include the cost of counting.\n");
+#endif
+
+        for (const auto & sceneFile : splitList(args["scenes"].get<string>()))
+        {
+            filesystem::path path(sceneFile);
+            getFileResolver().prepend(path.parent_path());
+
+            // every accelerator is fired at the same rays, generated with the first one
+            vector<RaySet> raySets;
+            for (const auto & type : accelerators)
+            {
+                Scene scene(loadSceneDescription(sceneFile, type));
+                if (raySets.empty())
+                    raySets = generateRays(scene, count, seed);
+
+                for (const auto & set : raySets)
+                {
+                    if (set.rays.empty())
+                        continue;
+
+                    resetStats();
+                    // Timer only counts whole milliseconds, which small ray sets finish within
+                    auto start = std::chrono::steady_clock::now();
+                    uint64_t hits = 0;
+                    HitInfo hit;
+                    for (const auto & ray : set.rays)
+                        hits += set.shadow ? scene.occluded(ray) : scene.closestHit(ray, hit);
+                    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+                    auto stats = statTotals();
+                    double rays = double(set.rays.size());
+                    string rate = seconds > 0.0 ? tfm::format("%8.3f", rays / seconds * 1e-6) : string("     n/a");
+                    message("%-24s %-6s %-10s %9d rays %9d hits %s Mrays/s %8.2f nodes/ray %8.2f prims/ray\n",
+                            path.filename(), type, set.name, set.rays.size(), hits, rate,
+                            stats[Stat::NodesVisited] / rays, stats[Stat::PrimitiveTests] / rays);
+                }
+            }
+        }
+    }
+    catch (const std::exception& e)
+    {
+        error("%s\n", e.what());
+        exit(EXIT_FAILURE);
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,81 @@
+/*
+    This file is part of Dirt, the Dartmouth introductory ray tracer.
+
+    Copyright (c) 2017-2019 by Wojciech Jarosz
+
+    Dirt is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Dirt is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <dirt/instance.h>
+#include <dirt/scene.h>
+
+
+Instance::Instance(const Scene & scene, const json & j, shared_ptr<const TriangleMesh> prototype)
+    : Surface(scene, j), m_prototype(prototype)
+{
+    m_material = scene.findOrCreateMaterial(j);
+}
+
+bool Instance::closestHit(const Ray3f &ray, HitInfo &hit) const
+{
+    // the transformed ray keeps its parametrization, so hit.t is valid in world space too
+    if (!m_prototype->closestHit(RayQuery3f(m_toLocal.ray(ray)), hit))
+        return false;
+
+    // claim the hit, so the shading data is computed (and transformed) by us
+    hit.surface = this;
+    return true;
+}
+
+uint32_t Instance::closestHit(RayPacket &packet, uint32_t mask, HitInfo hits[]) const
+{
+    RayPacket local = toLocal(packet, mask);
+    uint32_t hitMask = m_prototype->closestHit(local, mask, hits);
+    for (int k = 0; k < packet.size; ++k)
+        if (hitMask & (1u << k))
+        {
+            hits[k].surface = this;
+            packet.queries[k].ray.maxt = hits[k].t;
+        }
+    return hitMask;
+}
+
+void Instance::computeSurfaceInteraction(const Ray3f &ray, HitInfo &hit) const
+{
+    m_prototype->computeSurfaceInteraction(m_toLocal.ray(ray), hit);
+
+    hit.p = ray(hit.t);
+    hit.gn = normalize(m_toWorld.normal(hit.gn));
+    hit.sn = normalize(m_toWorld.normal(hit.sn));
+    hit.mat = m_material.get();
+    hit.surface = this;
+}
+
+bool Instance::occluded(const Ray3f &ray) const
+{
+    return m_prototype->occluded(RayQuery3f(m_toLocal.ray(ray)));
+}
+
+uint32_t Instance::occluded(const RayPacket &packet, uint32_t mask) const
+{
+    return m_prototype->occluded(toLocal(packet, mask), mask);
+}
+
+RayPacket Instance::toLocal(const RayPacket & packet, uint32_t mask) const
+{
+    RayPacket local = packet;
+    for (int k = 0; k < packet.size; ++k)
+        if (mask & (1u << k))
+            local.queries[k] = RayQuery3f(m_toLocal.ray(packet.queries[k].ray));
+    return local;
+}
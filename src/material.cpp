@@ -56,27 +56,27 @@ float Lambertian::pdf(const Vec3f& dirIn, const Vec3f& scattered, const HitInfo&
 {
 	return max(0.f, dot(scattered, hit.gn)) / M_PI;
 }
-Vec3f   randomCosineDirection()
+Vec3f   randomCosineDirection(Sampler& sampler)
 {
-	float phi = randf() * 2 * M_PI;
-	float cosTheta = sqrt(randf());
+	float phi = sampler.next1D() * 2 * M_PI;
+	float cosTheta = sqrt(sampler.next1D());
 	float 	sinTheta = sqrt(1 - cosTheta * cosTheta);
 	float	x = cos(phi) * sinTheta;
 	float	y = sin(phi) * sinTheta;
 	float	z = cosTheta;
 	return Vec3f(x, y, z);
 }
-bool Lambertian::sample(const Vec3f& dirIn, const HitInfo& hit, ScatterRecord& srec) const
+bool Lambertian::sample(const Vec3f& dirIn, const HitInfo& hit, ScatterRecord& srec, Sampler& sampler) const
 {
 	onb uvw;
 	uvw.build_form_w(hit.gn);
-	Vec3f direction = uvw.local(randomCosineDirection());
+	Vec3f direction = uvw.local(randomCosineDirection(sampler));
 	srec.scattered= direction;
 	srec.isSpecular = false;
 	return true;
 }
 
-bool Lambertian::scatter(const Ray3f &ray, const HitInfo &hit, Color3f &attenuation, Ray3f &scattered) const
+bool Lambertian::scatter(const Ray3f &ray, const HitInfo &hit, Color3f &attenuation, Ray3f &scattered, Sampler &sampler) const
 {
 	// TODO: Implement Lambertian reflection
 	//       You should assign the albedo to ``attenuation'', and
@@ -87,7 +87,7 @@ bool Lambertian::scatter(const Ray3f &ray, const HitInfo &hit, Color3f &attenuat
 
 	attenuation = this->albedo->value(hit);
 	scattered.o = hit.p;
-	scattered.d = normalize(normalize(randomInUnitSphere()) + hit.sn);
+	scattered.d = normalize(normalize(randomInUnitSphere(sampler)) + hit.sn);
 	//       You can get the hit point using hit.p, and the shading normal using hit.sn
 
 	//       Hint: You can use the function randomInUnitSphere() to get a random
@@ -111,7 +111,7 @@ Vec3f reflect(const Vec3f& v, const Vec3f& n)
 {
 	return v - 2 * dot(v, n) * n;
 }
-bool Metal::scatter(const Ray3f &ray, const HitInfo &hit, Color3f &attenuation, Ray3f &scattered) const
+bool Metal::scatter(const Ray3f &ray, const HitInfo &hit, Color3f &attenuation, Ray3f &scattered, Sampler &sampler) const
 {
 	// TODO: Implement metal reflection
 	//       This function proceeds similar to the lambertian material, except that the
@@ -126,7 +126,7 @@ bool Metal::scatter(const Ray3f &ray, const HitInfo &hit, Color3f &attenuation,
 	//scattered.o = hit.p;
 	///Vec3f ray_proj_n = dot(-ray.d, hit.sn) * hit.sn;
 	Vec3f refl = reflect(ray.d,hit.sn);
-	refl += roughness * randomInUnitSphere();
+	refl += roughness * randomInUnitSphere(sampler);
 	//       This procedure could produce directions below the surface. Handle this by returning false if the scattered direction and the shading normal
 	//       point in different directions (i.e. their dot product is negative)
 	if(dot(refl,hit.sn)<0)
@@ -159,7 +159,7 @@ float schlick(float cosine, float ref_idx)
 	r0 = r0 * r0;
 	return r0 + (1 - r0) * pow(1-cosine,5);
 }
-bool Dielectric::scatter(const Ray3f &ray, const HitInfo &hit, Color3f &attenuation, Ray3f &scattered) const
+bool Dielectric::scatter(const Ray3f &ray, const HitInfo &hit, Color3f &attenuation, Ray3f &scattered, Sampler &sampler) const
 {
 	// TODO: Implement dielectric scattering
 	
@@ -188,7 +188,7 @@ bool Dielectric::scatter(const Ray3f &ray, const HitInfo &hit, Color3f &attenuat
 	else {
 		reflect_prob = 1.f;
 	}
-	if (randf() < reflect_prob) {
+	if (sampler.next1D() < reflect_prob) {
 		scattered = Ray3f(hit.p, reflected);
 	}
 	else {
@@ -219,11 +219,11 @@ BlendMaterial::BlendMaterial(const json& j)
 	amount = j.at("amount");
 }
 
-bool BlendMaterial::scatter(const Ray3f& ray, const HitInfo& hit, Color3f& attenuation, Ray3f& scattered) const
+bool BlendMaterial::scatter(const Ray3f& ray, const HitInfo& hit, Color3f& attenuation, Ray3f& scattered, Sampler& sampler) const
 {
 	auto new_amount=amount * 0.212671f + amount * 0.715160f + amount * 0.072169f;
-	if (randf() < new_amount)return this->b->scatter(ray, hit, attenuation, scattered);
-	else return this->a->scatter(ray, hit, attenuation, scattered);
+	if (sampler.next1D() < new_amount)return this->b->scatter(ray, hit, attenuation, scattered, sampler);
+	else return this->a->scatter(ray, hit, attenuation, scattered, sampler);
 	//return true;
 }
 
@@ -248,22 +248,22 @@ Color3f Phong::eval(const Vec3f& dirIn, const Vec3f& scattered, const HitInfo& h
 {
 	return albedo->value(hit) * pdf(dirIn, scattered, hit);
 }
-Vec3f  randomCosinePowerHemisphere(float e)
+Vec3f  randomCosinePowerHemisphere(float e, Sampler& sampler)
 {
-	float phi = randf() * 2 * M_PI;
-	float cosTheta = powf(randf(), 1 / (e + 1));
+	float phi = sampler.next1D() * 2 * M_PI;
+	float cosTheta = powf(sampler.next1D(), 1 / (e + 1));
 	float 	sinTheta = sqrt(1 - cosTheta * cosTheta);
 	float	x = cos(phi) * sinTheta;
 	float	y = sin(phi) * sinTheta;
 	float	z = cosTheta;
 	return Vec3f(x, y, z);
 }
-bool Phong::sample(const Vec3f& dirIn, const HitInfo& hit, ScatterRecord& srec) const
+bool Phong::sample(const Vec3f& dirIn, const HitInfo& hit, ScatterRecord& srec, Sampler& sampler) const
 {
 	onb uvw;
 	auto mirrorDir = normalize(reflect(dirIn, hit.gn));
 	uvw.build_form_w(mirrorDir);
-	Vec3f direction = uvw.local(randomCosinePowerHemisphere(this->exponent));
+	Vec3f direction = uvw.local(randomCosinePowerHemisphere(this->exponent, sampler));
 	srec.scattered = direction;
 	srec.isSpecular = false;
 	if(dot(hit.gn,direction) < 0)return false;
@@ -18,6 +18,43 @@
 
 #include <dirt/mesh.h>
 #include <dirt/scene.h>
+#include <dirt/stats.h>
+
+// Moller-Trumbore ray-triangle test: only the hit distance t and the
+// barycentric coordinates u, v of the hit are computed
+bool singleTriangleIntersect(const Ray3f& ray,
+                             const Vec3f& p0, const Vec3f& p1, const Vec3f& p2,
+                             float& t, float& u, float& v)
+{
+    auto e1 = p1 - p0, e2 = p2 - p0, T = ray.o - p0;
+    auto p = cross(ray.d, e2), q = cross(T, e1);
+    auto p_dot_e1 = dot(p, e1), q_dot_e2 = dot(q, e2), p_dot_T = dot(p, T), q_dot_d = dot(q, ray.d);
+    if (p_dot_e1 == 0)return false;
+    t = q_dot_e2 / p_dot_e1;
+    u = p_dot_T / p_dot_e1;
+    v = q_dot_d / p_dot_e1;
+    if (u < 0 || u>1 || v < 0 || v>1 || u + v > 1)return false;
+    if (t<ray.mint || t>ray.maxt)return false;
+    return true;
+}
+
+// Moller-Trumbore with the precomputed edges and normal: rewriting the
+// triple products in terms of n = e1 x e2 and c = T x d leaves a single
+// cross product per test
+bool PrecomputedTriangle::intersect(const Ray3f& ray, float& t, float& u, float& v) const
+{
+    float det = -dot(ray.d, n);
+    if (det == 0)return false;
+    float invDet = 1.f / det;
+    auto T = ray.o - v0;
+    auto c = cross(T, ray.d);
+    u = dot(e2, c) * invDet;
+    v = -dot(e1, c) * invDet;
+    if (u < 0 || v < 0 || u + v > 1)return false;
+    t = dot(T, n) * invDet;
+    if (t<ray.mint || t>ray.maxt)return false;
+    return true;
+}
 
 // Ray-Triangle intersection
 // p0, p1, p2 - Triangle vertices
@@ -31,30 +68,25 @@ bool singleTriangleIntersect(const Ray3f& ray,
 	                         const Material * material,
 	                         const SurfaceBase * surface)
 {
-    // TODO: Implement ray-triangle intersection
-    // TODO: If the ray misses the triangle, you should return false
-    //       You can pick any ray triangle intersection routine you like.
-    //       I recommend you follow the Moller-Trumbore algorithm
-
-    //putYourCodeHere("Insert your ray-triangle intersection code here");
-    //return false;
-    // First, check for intersection and fill in the hitT
-    float hitT = 0.0f;
-    // You should also compute the u/v (i.e. the alpha/beta barycentric coordinates) of the hit point
-    // (Moller-Trumbore gives you this for free)
-    auto e1 = p1 - p0, e2 = p2 - p0, T = ray.o - p0;
-    auto p = cross(ray.d, e2), q = cross(T, e1);
-    auto p_dot_e1 = dot(p, e1), q_dot_e2 = dot(q, e2), p_dot_T = dot(p, T), q_dot_d = dot(q, ray.d);
-    if (p_dot_e1 == 0)return false;
-    hitT = q_dot_e2 / p_dot_e1;
-    float u = p_dot_T / p_dot_e1;
-    float v = q_dot_d / p_dot_e1;
-    // TODO: If you successfully hit the triangle, you should check if the hitT lies
-    //       within the ray's tmin/tfar, and return false if it does not
-    if (u < 0 || u>1 || v < 0 || v>1 || u + v > 1)return false;
-    if (hitT<ray.mint || hitT>ray.maxt)return false;
+    float t, u, v;
+    if (!singleTriangleIntersect(ray, p0, p1, p2, t, u, v))
+        return false;
+
+    triangleSurfaceInteraction(ray, t, u, v, p0, p1, p2, n0, n1, n2, uv0, uv1, uv2,
+                               hit, material, surface);
+    return true;
+}
+
+void triangleSurfaceInteraction(const Ray3f& ray, float t, float u, float v,
+                                const Vec3f& p0, const Vec3f& p1, const Vec3f& p2,
+                                const Vec3f* n0, const Vec3f* n1, const Vec3f* n2,
+                                const Vec2f* uv0, const Vec2f* uv1, const Vec2f* uv2,
+                                HitInfo& hit,
+                                const Material * material,
+                                const SurfaceBase * surface)
+{
     // TODO: Fill in the geometric normal with the geometric normal of the triangle (i.e. normalized cross product of the sides)
-    Vec3f gn = Vec3f(normalize(cross(e1,e2)));
+    Vec3f gn = Vec3f(normalize(cross(p1 - p0, p2 - p0)));
 
     // Compute the shading normal
     Vec3f sn;
@@ -80,58 +112,58 @@ bool singleTriangleIntersect(const Ray3f& ray,
         uv=(1 - u - v) * (*uv0) + u * (*uv1) + v * (*uv2);
     }
     // Because we've hit the triangle, fill in the intersection data
-    hit = HitInfo(hitT, ray(hitT), gn, sn, uv, material, surface);
-    return true;
+    hit.t = t;
+    hit.p = ray(t);
+    hit.gn = gn;
+    hit.sn = sn;
+    hit.uv = uv;
+    hit.mat = material;
+    hit.surface = surface;
 }
 
-Triangle::Triangle(const Scene & scene, const json & j, shared_ptr<const Mesh> mesh, uint32_t triNumber)
-    : m_mesh(mesh), m_faceIdx(triNumber)
+namespace
 {
-    
-}
 
-bool Triangle::intersect(const Ray3f &ray, HitInfo &hit) const
+// shading data of a hit on face \a f of \a mesh with barycentrics hit.uv
+void meshSurfaceInteraction(const Mesh & mesh, uint32_t f, const Ray3f &ray,
+                            HitInfo &hit, const SurfaceBase * surface)
 {
-    INCREMENT_INTERSECTION_TESTS;
-
-    auto i0 = m_mesh->F[m_faceIdx].x,
-         i1 = m_mesh->F[m_faceIdx].y,
-         i2 = m_mesh->F[m_faceIdx].z;
-    auto p0 = m_mesh->V[i0],
-         p1 = m_mesh->V[i1],
-         p2 = m_mesh->V[i2];
+    auto i0 = mesh.F[f].x,
+         i1 = mesh.F[f].y,
+         i2 = mesh.F[f].z;
+    auto p0 = mesh.V[i0],
+         p1 = mesh.V[i1],
+         p2 = mesh.V[i2];
     const Vec3f * n0 = nullptr, *n1 = nullptr, *n2 = nullptr;
-    if (!m_mesh->N.empty())
+    if (!mesh.N.empty())
     {
-        n0 = &m_mesh->N[i0];
-        n1 = &m_mesh->N[i1];
-        n2 = &m_mesh->N[i2];
+        n0 = &mesh.N[i0];
+        n1 = &mesh.N[i1];
+        n2 = &mesh.N[i2];
     }
     const Vec2f * t0 = nullptr, *t1 = nullptr, *t2 = nullptr;
-    if (!m_mesh->UV.empty())
+    if (!mesh.UV.empty())
     {
-        t0 = &m_mesh->UV[i0];
-        t1 = &m_mesh->UV[i1];
-        t2 = &m_mesh->UV[i2];
+        t0 = &mesh.UV[i0];
+        t1 = &mesh.UV[i1];
+        t2 = &mesh.UV[i2];
     }
 
-    return singleTriangleIntersect(ray,
-                                   p0, p1, p2,
-                                   n0, n1, n2,
-                                   t0,t1,t2,
-                                   hit, m_mesh->material.get(), this);
+    triangleSurfaceInteraction(ray, hit.t, hit.uv.x, hit.uv.y,
+                               p0, p1, p2,
+                               n0, n1, n2,
+                               t0, t1, t2,
+                               hit, mesh.material.get(), surface);
 }
 
-Box3f Triangle::localBBox() const
+// bounds of a triangle, expanded a bit if it lies in an axis-aligned plane
+Box3f triangleBounds(const Vec3f & p0, const Vec3f & p1, const Vec3f & p2)
 {
-	// all mesh vertices have already been transformed to world space,
-	// so we need to transform back to get the local space bounds
     Box3f result;
-    result.enclose(m_mesh->m_xform.inverse().point(vertex(0)));
-    result.enclose(m_mesh->m_xform.inverse().point(vertex(1)));
-    result.enclose(m_mesh->m_xform.inverse().point(vertex(2)));
-    
-    // if the triangle lies in an axis-aligned plane, expand the box a bit
+    result.enclose(p0);
+    result.enclose(p1);
+    result.enclose(p2);
+
     auto diag = result.diagonal();
     for (int i = 0; i < 3; ++i)
     {
@@ -144,24 +176,229 @@ Box3f Triangle::localBBox() const
     return result;
 }
 
+} // namespace
+
+Triangle::Triangle(const Scene & scene, const json & j, shared_ptr<const Mesh> mesh, uint32_t triNumber)
+    : m_mesh(mesh), m_faceIdx(triNumber)
+{
+    
+}
+
+bool Triangle::closestHit(const Ray3f &ray, HitInfo &hit) const
+{
+    DIRT_STAT(PrimitiveTests);
+
+    float t, u, v;
+    if (!singleTriangleIntersect(ray, vertex(0), vertex(1), vertex(2), t, u, v))
+        return false;
+
+    // keep the barycentrics around for computeSurfaceInteraction()
+    hit.t = t;
+    hit.uv = Vec2f(u, v);
+    hit.surface = this;
+    return true;
+}
+
+void Triangle::computeSurfaceInteraction(const Ray3f &ray, HitInfo &hit) const
+{
+    meshSurfaceInteraction(*m_mesh, m_faceIdx, ray, hit, this);
+}
+
+bool Triangle::occluded(const Ray3f &ray) const
+{
+    DIRT_STAT(PrimitiveTests);
+
+    float t, u, v;
+    return singleTriangleIntersect(ray, vertex(0), vertex(1), vertex(2), t, u, v);
+}
+
+Box3f Triangle::localBBox() const
+{
+	// all mesh vertices have already been transformed to world space,
+	// so we need to transform back to get the local space bounds
+    auto toLocal = m_mesh->m_xform.inverse();
+    return triangleBounds(toLocal.point(vertex(0)), toLocal.point(vertex(1)), toLocal.point(vertex(2)));
+}
+
 Box3f Triangle::worldBBox() const
 {
     // all mesh vertices have already been transformed to world space,
     // so just bound the triangle vertices
-    Box3f result;
-    result.enclose(vertex(0));
-    result.enclose(vertex(1));
-    result.enclose(vertex(2));
+    return triangleBounds(vertex(0), vertex(1), vertex(2));
+}
 
-    // if the triangle lies in an axis-aligned plane, expand the box a bit
-    auto diag = result.diagonal();
-    for (int i = 0; i < 3; ++i)
+
+TriangleMesh::TriangleMesh(const Scene & scene, const json & j, shared_ptr<const Mesh> mesh)
+    : m_mesh(mesh), m_tree(j.value("accelerator", json::object()))
+{
+    // the mesh never changes, so build the tree right away
+    auto toLocal = m_mesh->m_xform.inverse();
+    vector<Box3f> bounds(m_mesh->F.size());
+    for (auto f : range(uint32_t(m_mesh->F.size())))
     {
-        if (diag[i] < 1e-4f)
+        bounds[f] = triangleBounds(vertex(f, 0), vertex(f, 1), vertex(f, 2));
+        m_localBBox.enclose(triangleBounds(toLocal.point(vertex(f, 0)),
+                                           toLocal.point(vertex(f, 1)),
+                                           toLocal.point(vertex(f, 2))));
+    }
+
+    m_faces = m_tree.build(bounds);
+
+    setupTriangles(j.value("accelerator", json::object()));
+}
+
+TriangleMesh::TriangleMesh(const json & j, shared_ptr<const Mesh> mesh, vector<uint32_t> faces,
+                           LinearBBH tree, const Box3f & localBBox)
+    : m_mesh(mesh), m_faces(std::move(faces)), m_tree(std::move(tree)), m_localBBox(localBBox)
+{
+    setupTriangles(j.value("accelerator", json::object()));
+}
+
+void TriangleMesh::setupTriangles(const json & accelerator)
+{
+    string triangles = accelerator.value("triangles", string("indexed"));
+    if (triangles == "precomputed")
+    {
+        m_precomputed.resize(m_faces.size());
+        for (auto i : range(m_faces.size()))
         {
-            result.pMin[i] -= 5e-5f;
-            result.pMax[i] += 5e-5f;
+            auto f = m_faces[i];
+            m_precomputed[i] = PrecomputedTriangle(vertex(f, 0), vertex(f, 1), vertex(f, 2));
         }
+        debug("Precomputed %d triangles (%s).\n", m_precomputed.size(),
+              memString(m_precomputed.size() * sizeof(PrecomputedTriangle)));
     }
-    return result;
-}
\ No newline at end of file
+    else if (triangles != "indexed")
+        throw DirtException("Unknown mesh 'triangles' layout '%s' here:\n%s.", triangles, accelerator.dump(4));
+
+    // the mesh is complete now, whether it was built or read from a cache
+    addMemoryUsage(MemoryCategory::Meshes, m_mesh->memoryUsage() + m_faces.size() * sizeof(uint32_t) +
+                                           m_precomputed.size() * sizeof(PrecomputedTriangle));
+    addMemoryUsage(MemoryCategory::BBH, m_tree.memoryUsage());
+}
+
+bool TriangleMesh::closestHit(const Ray3f &ray, HitInfo &hit) const
+{
+    return closestHit(RayQuery3f(ray), hit);
+}
+
+bool TriangleMesh::closestHit(const RayQuery3f &_query, HitInfo &hit) const
+{
+    // copy the query so we can shrink maxt as closer hits are found
+    RayQuery3f query = _query;
+    bool hitSomething = false;
+
+    m_tree.traverse(query, [&](uint32_t begin, uint32_t end)
+    {
+        for (auto i : range(begin, end))
+        {
+            DIRT_STAT(PrimitiveTests);
+
+            float t, u, v;
+            if (triangleHit(i, query.ray, t, u, v))
+            {
+                // keep the face and barycentrics around for computeSurfaceInteraction()
+                hit.t = query.ray.maxt = t;
+                hit.uv = Vec2f(u, v);
+                hit.primitive = m_faces[i];
+                hit.surface = this;
+                hitSomething = true;
+            }
+        }
+        return false;
+    });
+
+    return hitSomething;
+}
+
+void TriangleMesh::computeSurfaceInteraction(const Ray3f &ray, HitInfo &hit) const
+{
+    meshSurfaceInteraction(*m_mesh, hit.primitive, ray, hit, this);
+}
+
+bool TriangleMesh::occluded(const Ray3f &ray) const
+{
+    return occluded(RayQuery3f(ray));
+}
+
+bool TriangleMesh::occluded(const RayQuery3f &query) const
+{
+    bool hitSomething = false;
+
+    // stop the traversal as soon as any triangle is hit
+    m_tree.traverse(query, [&](uint32_t begin, uint32_t end)
+    {
+        for (auto i : range(begin, end))
+        {
+            DIRT_STAT(PrimitiveTests);
+
+            float t, u, v;
+            if (triangleHit(i, query.ray, t, u, v))
+                return hitSomething = true;
+        }
+        return false;
+    });
+
+    return hitSomething;
+}
+
+uint32_t TriangleMesh::closestHit(RayPacket &packet, uint32_t mask, HitInfo hits[]) const
+{
+    uint32_t hitMask = 0;
+    m_tree.traverse(packet, mask, [&](uint32_t begin, uint32_t end, uint32_t rays)
+    {
+        // fetch each triangle once for all rays of the packet that reach it
+        for (auto i : range(begin, end))
+        {
+            for (int k = 0; k < packet.size; ++k)
+            {
+                if (!(rays & (1u << k)))
+                    continue;
+
+                DIRT_STAT(PrimitiveTests);
+
+                float t, u, v;
+                if (triangleHit(i, packet.queries[k].ray, t, u, v))
+                {
+                    hits[k].t = packet.queries[k].ray.maxt = t;
+                    hits[k].uv = Vec2f(u, v);
+                    hits[k].primitive = m_faces[i];
+                    hits[k].surface = this;
+                    hitMask |= 1u << k;
+                }
+            }
+        }
+        return 0u;
+    });
+
+    return hitMask;
+}
+
+uint32_t TriangleMesh::occluded(const RayPacket &packet, uint32_t mask) const
+{
+    uint32_t occludedMask = 0;
+    m_tree.traverse(packet, mask, [&](uint32_t begin, uint32_t end, uint32_t rays)
+    {
+        uint32_t occluded = 0;
+        for (auto i : range(begin, end))
+        {
+            for (int k = 0; k < packet.size; ++k)
+            {
+                if (!((rays & ~occluded) & (1u << k)))
+                    continue;
+
+                DIRT_STAT(PrimitiveTests);
+
+                float t, u, v;
+                if (triangleHit(i, packet.queries[k].ray, t, u, v))
+                    occluded |= 1u << k;
+            }
+            if (occluded == rays)
+                break;
+        }
+        occludedMask |= occluded;
+        return occluded;
+    });
+
+    return occludedMask;
+}
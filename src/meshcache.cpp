@@ -0,0 +1,230 @@
+/*
+    This file is part of Dirt, the Dartmouth introductory ray tracer.
+
+    Copyright (c) 2017-2019 by Wojciech Jarosz
+
+    Dirt is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Dirt is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <dirt/meshcache.h>
+#include <dirt/binaryfile.h>
+#include <dirt/obj.h>
+#include <dirt/scene.h>
+#include <dirt/stats.h>
+#include <dirt/timer.h>
+#include <sys/stat.h>
+
+namespace
+{
+
+// Bump this whenever the layout of the cache (or of anything stored in it) changes
+const uint32_t MeshCacheVersion = 2;
+
+/**
+    Everything a cache file must agree on with the current run to be used.
+
+    Made only of explicitly sized fields without padding, so two headers
+    can be compared bytewise.
+ */
+struct MeshCacheHeader
+{
+    char magic[8];                      ///< "DIRTMSH" and a terminating 0
+    uint32_t version;                   ///< MeshCacheVersion
+    uint32_t nodeSizes;                 ///< Sizes of the node types, as a layout sanity check
+    uint64_t fileSize;                  ///< Size of the OBJ file in bytes
+    int64_t fileTime;                   ///< Modification time of the OBJ file in nanoseconds
+    float xform[16];                    ///< The transform baked into the vertices
+};
+
+static_assert(sizeof(MeshCacheHeader) == 96, "MeshCacheHeader should not contain padding");
+
+/// Compute the header a valid cache of \a filename must have, or return false if \a filename cannot be read
+bool expectedHeader(const string & filename, const Transform & xform, MeshCacheHeader & header)
+{
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0)
+        return false;
+
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "DIRTMSH", 8);
+    header.version = MeshCacheVersion;
+    header.nodeSizes = uint32_t(sizeof(LinearBBHNode)) |
+                       uint32_t(sizeof(WideBBHNode<4>)) << 8 |
+                       uint32_t(sizeof(WideBBHNode<8>)) << 16;
+    header.fileSize = uint64_t(st.st_size);
+    // with whole seconds, an edit within a second of writing the cache would go unnoticed
+#if defined(__APPLE__)
+    header.fileTime = int64_t(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+    header.fileTime = int64_t(st.st_mtime) * 1000000000;
+#else
+    header.fileTime = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    for (int r = 0; r < 4; ++r)
+        for (int c = 0; c < 4; ++c)
+            header.xform[4 * r + c] = xform.m(r, c);
+    return true;
+}
+
+/**
+    Name of the cache file for \a filename loaded with \a xform and the tree parameters in \a j.
+
+    Each transform and set of tree parameters gets its own file, so meshes and
+    instances of the same OBJ file do not keep overwriting each other's cache.
+ */
+string cacheFileName(const json & j, const string & filename, const Transform & xform)
+{
+    json accelerator = j.value("accelerator", json::object());
+    // the thread count does not change the tree
+    accelerator.erase("build_threads");
+    string parameters = accelerator.dump();
+
+    uint64_t hash = hashBytes(parameters.data(), parameters.size());
+    for (int r = 0; r < 4; ++r)
+        for (int c = 0; c < 4; ++c)
+        {
+            float m = xform.m(r, c);
+            hash = hashBytes(&m, sizeof(m), hash);
+        }
+
+    return tfm::format("%s.%016x.dirtcache", filename, hash);
+}
+
+/// Read the mesh cached in \a cacheFile, or return nullptr if it is missing or out of date
+shared_ptr<TriangleMesh> readCache(const Scene & scene, const json & j, const string & cacheFile,
+                                   const MeshCacheHeader & expected)
+{
+    struct stat st;
+    if (stat(cacheFile.c_str(), &st) != 0)
+        return nullptr;
+
+    Timer timer;
+    PhaseTimer phaseTimer(Phase::MeshLoad);
+    MemoryMappedFile file(cacheFile);
+    BinaryReader reader(file.data(), file.size());
+
+    auto header = reader.read<MeshCacheHeader>();
+    if (std::memcmp(&header, &expected, sizeof(header)) != 0)
+    {
+        message("Mesh cache '%s' is out of date.\n", cacheFile);
+        return nullptr;
+    }
+
+    auto mesh = make_shared<Mesh>();
+    reader.read(mesh->V);
+    reader.read(mesh->N);
+    reader.read(mesh->UV);
+    reader.read(mesh->F);
+
+    vector<uint32_t> faces;
+    reader.read(faces);
+    auto localBBox = reader.read<Box3f>();
+
+    LinearBBH tree(j.value("accelerator", json::object()));
+    if (!tree.read(reader, faces.size()))
+    {
+        message("Mesh cache '%s' was built with different BBH parameters.\n", cacheFile);
+        return nullptr;
+    }
+
+    // guard against indexing out of bounds if the file was damaged
+    if ((!mesh->N.empty() && mesh->N.size() != mesh->V.size()) ||
+        (!mesh->UV.empty() && mesh->UV.size() != mesh->V.size()) ||
+        faces.size() != mesh->F.size())
+        throw DirtException("Inconsistent array sizes.");
+    for (auto f : faces)
+        if (f >= mesh->F.size())
+            throw DirtException("Face index %d out of range.", f);
+    for (const auto & face : mesh->F)
+        for (int i = 0; i < 3; ++i)
+            if (uint32_t(face[i]) >= mesh->V.size())
+                throw DirtException("Vertex index %d out of range.", face[i]);
+
+    if (mesh->empty())
+        return nullptr;
+    mesh->material = scene.findOrCreateMaterial(j);
+
+    message("Loaded mesh cache '%s' (V=%d, F=%d, took %s).\n", cacheFile,
+            mesh->V.size(), mesh->F.size(), timer.elapsedString());
+
+    return make_shared<TriangleMesh>(j, mesh, std::move(faces), std::move(tree), localBBox);
+}
+
+/// Write \a surface to \a cacheFile, going through a temporary file so readers never see a partial cache
+void writeCache(const TriangleMesh & surface, const string & cacheFile, const MeshCacheHeader & header)
+{
+    string tempFile = cacheFile + ".tmp";
+    {
+        BinaryWriter writer(tempFile);
+        writer.write(header);
+
+        const Mesh & mesh = surface.mesh();
+        writer.write(mesh.V);
+        writer.write(mesh.N);
+        writer.write(mesh.UV);
+        writer.write(mesh.F);
+
+        writer.write(surface.faces());
+        writer.write(surface.localBBox());
+        surface.tree().write(writer);
+        writer.close();
+    }
+
+    replaceFile(tempFile, cacheFile);
+}
+
+} // namespace
+
+
+shared_ptr<TriangleMesh> loadTriangleMesh(const Scene & scene, const json & j,
+                                          const string & filename, const Transform & xform)
+{
+    string cacheFile = cacheFileName(j, filename, xform);
+    MeshCacheHeader header;
+    bool useCache = j.value("cache", true) && expectedHeader(filename, xform, header);
+
+    if (useCache)
+    {
+        try
+        {
+            if (auto surface = readCache(scene, j, cacheFile, header))
+                return surface;
+        }
+        catch (const std::exception & e)
+        {
+            warning("Ignoring mesh cache '%s': %s\n", cacheFile, e.what());
+        }
+    }
+
+    auto mesh = make_shared<Mesh>(loadWavefrontOBJ(filename, xform));
+    if (mesh->empty())
+        return nullptr;
+    mesh->material = scene.findOrCreateMaterial(j);
+
+    auto surface = make_shared<TriangleMesh>(scene, j, mesh);
+
+    if (useCache)
+    {
+        try
+        {
+            writeCache(*surface, cacheFile, header);
+            debug("Wrote mesh cache '%s'.\n", cacheFile);
+        }
+        catch (const std::exception & e)
+        {
+            warning("Could not write mesh cache '%s': %s\n", cacheFile, e.what());
+        }
+    }
+
+    return surface;
+}
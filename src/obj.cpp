@@ -23,223 +23,630 @@
 */
 
 #include <dirt/obj.h>
+#include <dirt/binaryfile.h>
 #include <dirt/timer.h>
 #include <dirt/progress.h>
+#include <dirt/parallel.h>
+#include <dirt/stats.h>
 #include <unordered_map>
-#include <fstream>
+#include <cstdlib>
 
 namespace
 {
 
-/// Tokenize a string into a list by splitting at 'delim'
-std::vector<std::string> tokenize(const std::string & string, const std::string & delim = ", ", bool includeEmpty = false)
+/**
+    Vertex indices used by the OBJ format.
+
+    Indices are 1-based, and 0 marks a missing texture coordinate or normal.
+    While a chunk of the file is parsed, relative (negative) indices are
+    stored offset by -ChunkRelative; see absoluteIndex().
+ */
+struct OBJVertex
 {
-    std::string::size_type lastPos = 0, pos = string.find_first_of(delim, lastPos);
-    std::vector<std::string> tokens;
+    int32_t p = 0;
+    int32_t uv = 0;
+    int32_t n = 0;
 
-    while (lastPos != std::string::npos)
+    inline bool operator==(const OBJVertex & v) const
     {
-        if (pos != lastPos || includeEmpty)
-            tokens.push_back(string.substr(lastPos, pos - lastPos));
-        lastPos = pos;
-        if (lastPos != std::string::npos)
-        {
-            lastPos += 1;
-            pos = string.find_first_of(delim, lastPos);
-        }
+        return v.p == p && v.n == n && v.uv == uv;
     }
+};
 
-    return tokens;
-}
-
-/// Convert a string into an unsigned integer value
-unsigned int toUInt(const std::string & str)
+/// Hash function for OBJVertex
+struct OBJVertexHash
 {
-    char *end_ptr = nullptr;
-    unsigned int result = (int) strtoul(str.c_str(), &end_ptr, 10);
-    if (*end_ptr != '\0')
-        throw DirtException("Could not parse integer value '%s'", str);
-    return result;
-}
+    std::size_t operator()(const OBJVertex & v) const
+    {
+        size_t hash = std::hash<int32_t>()(v.p);
+        hash = hash * 37 + std::hash<int32_t>()(v.uv);
+        hash = hash * 37 + std::hash<int32_t>()(v.n);
+        return hash;
+    }
+};
 
-/// Vertex indices used by the OBJ format
-struct OBJVertex
+/// The parsed contents of (a chunk of) an OBJ file
+struct OBJData
 {
-    uint32_t p = (uint32_t) -1;
-    uint32_t n = (uint32_t) -1;
-    uint32_t uv = (uint32_t) -1;
+    vector<Vec3f> positions;
+    vector<Vec2f> texcoords;
+    vector<Vec3f> normals;
+    vector<OBJVertex> vertices;         ///< The corners of all triangles, three per triangle
+};
 
-    inline OBJVertex()
-    {
-    }
+// Report progress in steps of this many bytes, to keep the atomic counter cold
+const ptrdiff_t ProgressGranularity = 1 << 16;
 
-    inline OBJVertex(const std::string & string)
-    {
-        std::vector<std::string> tokens = tokenize(string, "/", true);
+// Files are split into chunks of at least this many bytes for parsing
+const size_t MinChunkSize = 1 << 20;
 
-        if (tokens.size() < 1 || tokens.size() > 3)
-            throw DirtException("Invalid vertex data: '%s'", string);
+// Meshes with fewer triangle corners are deduplicated on a single thread
+const size_t MinParallelCorners = 1 << 18;
 
-        p = toUInt(tokens[0]);
+// Offset of chunk-relative indices, see absoluteIndex()
+const int32_t ChunkRelative = 1 << 30;
 
-        if (tokens.size() >= 2 && !tokens[1].empty())
-            uv = toUInt(tokens[1]);
+// Exactly representable powers of ten, for the fast path of parseFloat()
+const double Pow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
 
-        if (tokens.size() >= 3 && !tokens[2].empty())
-            n = toUInt(tokens[2]);
-    }
+inline bool isSpace(char c) {return c == ' ' || c == '\t' || c == '\r';}
+inline bool isDigit(char c) {return c >= '0' && c <= '9';}
 
-    inline bool operator==(const OBJVertex & v) const
+inline void skipSpaces(const char *& p, const char * end)
+{
+    while (p < end && isSpace(*p))
+        ++p;
+}
+
+/// Return the end of the line starting at \a p (the position of its '\n', or \a end)
+inline const char * findLineEnd(const char * p, const char * end)
+{
+    auto eol = static_cast<const char *>(std::memchr(p, '\n', end - p));
+    return eol ? eol : end;
+}
+
+/**
+    Parse a floating point number at \a p, and advance \a p past it.
+
+    Plain decimal numbers with up to 19 significant digits and a small
+    exponent, i.e. virtually everything OBJ exporters write, are converted
+    with a single correctly rounded multiplication or division. Anything else
+    (long mantissas, huge exponents, "nan", ...) is handed to strtof.
+
+    \return false if there is no number at \a p
+ */
+bool parseFloat(const char *& p, const char * end, float & value)
+{
+    const char * start = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    for (; p < end && isDigit(*p); ++p, ++digits)
+        mantissa = mantissa * 10 + uint64_t(*p - '0');
+    if (p < end && *p == '.')
+        for (++p; p < end && isDigit(*p); ++p, ++digits, --exponent)
+            mantissa = mantissa * 10 + uint64_t(*p - '0');
+
+    bool fast = digits > 0 && digits <= 19;
+    if (fast && p < end && (*p == 'e' || *p == 'E'))
     {
-        return v.p == p && v.n == n && v.uv == uv;
+        ++p;
+        bool negativeExponent = false;
+        if (p < end && (*p == '-' || *p == '+'))
+            negativeExponent = *p++ == '-';
+        int e = 0;
+        fast = p < end && isDigit(*p);
+        for (; p < end && isDigit(*p) && e < 10000; ++p)
+            e = e * 10 + (*p - '0');
+        exponent += negativeExponent ? -e : e;
     }
-};
+    fast = fast && mantissa <= (uint64_t(1) << 53) && exponent >= -22 && exponent <= 22 &&
+           (p == end || isSpace(*p) || *p == '\n' || *p == '/');
 
-/// Hash function for OBJVertex
-struct OBJVertexHash : std::unary_function<OBJVertex, size_t>
-{
-    std::size_t operator()(const OBJVertex & v) const
+    if (fast)
     {
-        size_t hash = std::hash<uint32_t>()(v.p);
-        hash = hash * 37 + std::hash<uint32_t>()(v.uv);
-        hash = hash * 37 + std::hash<uint32_t>()(v.n);
-        return hash;
+        double d = double(mantissa);
+        d = exponent < 0 ? d / Pow10[-exponent] : d * Pow10[exponent];
+
+        // rounding to double and then to float only differs from rounding
+        // straight to float if the double lands exactly halfway between two floats
+        uint64_t bits;
+        std::memcpy(&bits, &d, sizeof(d));
+        if ((bits & 0x1FFFFFFF) != 0x10000000)
+        {
+            value = float(negative ? -d : d);
+            return true;
+        }
     }
-};
 
-} // namespace
+    // slow path: strtof needs a 0-terminated copy of the whole token, which
+    // must be consumed entirely so p ends up at whitespace or the end of the line
+    p = start;
+    while (p < end && !isSpace(*p) && *p != '\n')
+        ++p;
+    string token(start, p);
 
+    char * parsedEnd = nullptr;
+    value = std::strtof(token.c_str(), &parsedEnd);
+    return !token.empty() && parsedEnd == token.c_str() + token.size();
+}
 
-Mesh loadWavefrontOBJ(const std::string & filename, const Transform & xform)
+/// Parse a (possibly negative) integer at \a p, and advance \a p past it
+bool parseInt(const char *& p, const char * end, int32_t & value)
 {
-    typedef std::unordered_map<OBJVertex, uint32_t, OBJVertexHash> VertexMap;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+    if (p == end || !isDigit(*p))
+        return false;
+
+    int64_t v = 0;
+    for (; p < end && isDigit(*p) && v <= std::numeric_limits<int32_t>::max(); ++p)
+        v = v * 10 + (*p - '0');
+    if (v > std::numeric_limits<int32_t>::max())
+        return false;
+    value = int32_t(negative ? -v : v);
+    return true;
+}
 
-    std::ifstream is(filename);
-    if (is.fail())
-        throw DirtException("Unable to open OBJ file '%s'!", filename);
+/**
+    Turn a relative (negative) OBJ index into an absolute one, given the
+    number of elements defined so far in the current chunk.
 
-    message("Loading '%s' ... \n", filename);
-    Timer timer;
+    The number of elements in the chunks before it is not known yet, so
+    the result is stored offset by -ChunkRelative (making it negative) and
+    completed by resolveIndex() once the chunks are merged.
+ */
+inline int32_t absoluteIndex(int32_t index, size_t count)
+{
+    // (indices reaching back beyond a chunk offset this far are invalid anyway)
+    return index < 0 ? int32_t(count) + std::max(index, -ChunkRelative) + 1 - ChunkRelative : index;
+}
+
+/// Complete an index returned by absoluteIndex() in a chunk preceded by \a offset elements
+inline int32_t resolveIndex(int32_t index, size_t offset)
+{
+    return index < 0 ? index + ChunkRelative + int32_t(offset) : index;
+}
 
-    std::vector<Vec3f>    positions;
-    std::vector<Vec2f>    texcoords;
-    std::vector<Vec3f>    normals;
-    std::vector<uint32_t>   indices;
-    std::vector<OBJVertex>  vertices;
-    VertexMap vertexMap;
+/// Parse a face vertex "p", "p/uv", "p//n" or "p/uv/n" at \a p
+bool parseFaceVertex(const char *& p, const char * end, const OBJData & data, OBJVertex & v)
+{
+    if (!parseInt(p, end, v.p))
+        return false;
+    v.p = absoluteIndex(v.p, data.positions.size());
 
-    // compute line count
-    size_t lineCount = 0;
+    if (p < end && *p == '/')
     {
-        // new lines will be skipped unless we stop it from happening:    
-        is.unsetf(std::ios_base::skipws);
+        ++p;
+        if (p < end && *p != '/' && !isSpace(*p) && *p != '\n')
+        {
+            if (!parseInt(p, end, v.uv))
+                return false;
+            v.uv = absoluteIndex(v.uv, data.texcoords.size());
+        }
+        if (p < end && *p == '/')
+        {
+            ++p;
+            if (!parseInt(p, end, v.n))
+                return false;
+            v.n = absoluteIndex(v.n, data.normals.size());
+        }
+    }
+    return p == end || isSpace(*p) || *p == '\n';
+}
 
-        lineCount = std::count(
-            std::istream_iterator<char>(is),
-            std::istream_iterator<char>(), 
-            '\n');
+/// Classify the line starting at \a p by its keyword
+enum class OBJLine {Position, Texcoord, Normal, Face, Other};
 
-        is.clear();
-        is.seekg(0, is.beg);
+OBJLine lineType(const char * p, const char * eol)
+{
+    skipSpaces(p, eol);
+    if (eol - p < 2)
+        return OBJLine::Other;
+    if (p[0] == 'f' && isSpace(p[1]))
+        return OBJLine::Face;
+    if (p[0] != 'v')
+        return OBJLine::Other;
+    if (isSpace(p[1]))
+        return OBJLine::Position;
+    if (eol - p >= 3 && isSpace(p[2]))
+    {
+        if (p[1] == 't')
+            return OBJLine::Texcoord;
+        if (p[1] == 'n')
+            return OBJLine::Normal;
     }
+    return OBJLine::Other;
+}
 
-    Mesh mesh;
-    Box3f bbox;
+/**
+    Reserve the arrays of \a data for the OBJ file [begin, end).
 
-    {
-        Progress progress("Reading OBJ file", lineCount);
+    The number of elements is extrapolated from the lines found in a few
+    samples spread over the file (OBJ files usually list all vertices
+    before all faces, so the start of the file alone would be misleading).
+ */
+void reserveByEstimate(const char * begin, const char * end, OBJData & data)
+{
+    const size_t NumSamples = 16, SampleSize = 16 * 1024;
+    size_t size = end - begin;
+    size_t numSamples = size > NumSamples * SampleSize ? NumSamples : 1;
 
-        std::string line_str;
-        while (std::getline(is, line_str))
+    size_t counts[4] = {0, 0, 0, 0}, sampled = 0;
+    for (size_t s = 0; s < numSamples; ++s)
+    {
+        const char * p = begin + size * s / numSamples;
+        const char * sampleEnd = numSamples == 1 ? end : p + SampleSize;
+        // start at a line boundary
+        if (p != begin)
+            p = std::min(findLineEnd(p, sampleEnd) + 1, sampleEnd);
+        sampled += sampleEnd - p;
+
+        while (p < sampleEnd)
         {
-            std::istringstream line(line_str);
+            const char * eol = findLineEnd(p, sampleEnd);
+            skipSpaces(p, eol);
+            auto type = lineType(p, eol);
+            if (type == OBJLine::Face)
+            {
+                // a face with n corners becomes n - 2 triangles
+                int corners = 0;
+                for (const char * c = p + 1; c < eol; ++c)
+                    corners += isSpace(c[-1]) && !isSpace(c[0]);
+                counts[int(type)] += 3 * std::max(corners - 2, 1);
+            }
+            else if (type != OBJLine::Other)
+                ++counts[int(type)];
+            p = eol + 1;
+        }
+    }
+
+    double scale = sampled ? 1.1 * double(size) / double(sampled) : 0.0;
+    data.positions.reserve(size_t(counts[int(OBJLine::Position)] * scale));
+    data.texcoords.reserve(size_t(counts[int(OBJLine::Texcoord)] * scale));
+    data.normals.reserve(size_t(counts[int(OBJLine::Normal)] * scale));
+    data.vertices.reserve(size_t(counts[int(OBJLine::Face)] * scale));
+}
 
-            std::string prefix;
-            line >> prefix;
+/// Parse the OBJ lines in [begin, end) into \a data, transforming positions and normals by \a xform
+void parseOBJ(const char * begin, const char * end, const Transform & xform,
+              OBJData & data, Progress & progress)
+{
+    const char * reported = begin;
+    for (const char * line = begin; line < end; )
+    {
+        const char * eol = findLineEnd(line, end);
+        const char * p = line;
+        skipSpaces(p, eol);
 
-            if (prefix == "v")
+        switch (lineType(p, eol))
+        {
+            case OBJLine::Position:
             {
-                Vec3f p;
-                line >> p.x >> p.y >> p.z;
-                p = xform.point(p);
-                positions.push_back(p);
+                Vec3f v;
+                p += 1;
+                skipSpaces(p, eol);
+                for (int i = 0; i < 3; ++i, skipSpaces(p, eol))
+                    if (!parseFloat(p, eol, v[i]))
+                        throw DirtException("Invalid vertex position: '%s'", string(line, eol));
+                data.positions.push_back(xform.point(v));
+                break;
             }
-            else if (prefix == "vt")
+            case OBJLine::Texcoord:
             {
-                Vec2f tc;
-                line >> tc.x >> tc.y;
-                texcoords.push_back(tc);
+                Vec2f uv(0.f);
+                p += 2;
+                skipSpaces(p, eol);
+                if (!parseFloat(p, eol, uv.x))
+                    throw DirtException("Invalid texture coordinate: '%s'", string(line, eol));
+                skipSpaces(p, eol);
+                if (p < eol && !parseFloat(p, eol, uv.y))
+                    throw DirtException("Invalid texture coordinate: '%s'", string(line, eol));
+                data.texcoords.push_back(uv);
+                break;
             }
-            else if (prefix == "vn")
+            case OBJLine::Normal:
             {
                 Vec3f n;
-                line >> n.x >> n.y >> n.z;
-                normals.push_back(normalize(xform.normal(n)));
+                p += 2;
+                skipSpaces(p, eol);
+                for (int i = 0; i < 3; ++i, skipSpaces(p, eol))
+                    if (!parseFloat(p, eol, n[i]))
+                        throw DirtException("Invalid vertex normal: '%s'", string(line, eol));
+                data.normals.push_back(normalize(xform.normal(n)));
+                break;
             }
-            else if (prefix == "f")
+            case OBJLine::Face:
             {
-                std::string v1, v2, v3, v4;
-                line >> v1 >> v2 >> v3 >> v4;
-                OBJVertex verts[6];
-                int nVertices = 3;
-
-                verts[0] = OBJVertex(v1);
-                verts[1] = OBJVertex(v2);
-                verts[2] = OBJVertex(v3);
-
-                if (!v4.empty())
+                // triangulate polygons as a fan around their first corner, which
+                // splits quads the same way as before
+                OBJVertex first, previous, v;
+                int corners = 0;
+                p += 1;
+                for (skipSpaces(p, eol); p < eol; skipSpaces(p, eol), ++corners)
                 {
-                    // This is a quad, split into two triangles
-                    verts[3] = OBJVertex(v4);
-                    verts[4] = verts[0];
-                    verts[5] = verts[2];
-                    nVertices = 6;
-                }
+                    if (!parseFaceVertex(p, eol, data, v))
+                        throw DirtException("Invalid vertex data: '%s'", string(line, eol));
 
-                // Convert to an indexed vertex list
-                for (auto i : range(nVertices))
-                {
-                    const OBJVertex & v = verts[i];
-                    VertexMap::const_iterator it = vertexMap.find(v);
-                    if (it == vertexMap.end())
+                    if (corners == 0)
+                        first = v;
+                    else if (corners == 2)
                     {
-                        vertexMap[v] = (uint32_t) vertices.size();
-                        indices.push_back((uint32_t) vertices.size());
-                        vertices.push_back(v);
+                        data.vertices.push_back(first);
+                        data.vertices.push_back(previous);
+                        data.vertices.push_back(v);
                     }
-                    else
+                    else if (corners > 2)
                     {
-                        indices.push_back(it->second);
+                        data.vertices.push_back(v);
+                        data.vertices.push_back(first);
+                        data.vertices.push_back(previous);
                     }
+                    previous = v;
                 }
+                if (corners < 3)
+                    throw DirtException("Invalid face with fewer than three vertices: '%s'", string(line, eol));
+                break;
             }
-            ++progress;
+            case OBJLine::Other:
+                // comments, groups, materials, ... are ignored
+                break;
         }
 
-        mesh.F.resize(indices.size()/3);
-        for (auto i : range(int(mesh.F.size())))
-            mesh.F[i] = Vec3i(indices[3*i], indices[3*i+1], indices[3*i+2]);
+        line = eol + 1;
+        if (line - reported >= ProgressGranularity)
+        {
+            progress += std::min(line, end) - reported;
+            reported = line;
+        }
+    }
+    progress += end - std::min(reported, end);
+}
 
-        mesh.V.resize(vertices.size());
-        for (auto i : range(int(vertices.size())))
+/**
+    Merge the per-chunk arrays into one, resolving relative indices.
+
+    The offset of each chunk's elements in the merged arrays is the prefix
+    sum of the sizes of the chunks before it. The chunks are copied in
+    parallel, and released as soon as they are copied.
+ */
+OBJData mergeChunks(vector<OBJData> & chunks)
+{
+    struct Offsets {size_t positions = 0, texcoords = 0, normals = 0, vertices = 0;};
+    vector<Offsets> offsets(chunks.size() + 1);
+    for (auto c : range(chunks.size()))
+    {
+        offsets[c + 1].positions = offsets[c].positions + chunks[c].positions.size();
+        offsets[c + 1].texcoords = offsets[c].texcoords + chunks[c].texcoords.size();
+        offsets[c + 1].normals   = offsets[c].normals   + chunks[c].normals.size();
+        offsets[c + 1].vertices  = offsets[c].vertices  + chunks[c].vertices.size();
+    }
+
+    OBJData data;
+    if (chunks.size() == 1)
+        data = std::move(chunks[0]);
+    else
+    {
+        data.positions.resize(offsets.back().positions);
+        data.texcoords.resize(offsets.back().texcoords);
+        data.normals.resize(offsets.back().normals);
+        data.vertices.resize(offsets.back().vertices);
+    }
+
+    parallelChunks(0, chunks.size(), int(chunks.size()), [&](int c, size_t, size_t)
+    {
+        OBJData & chunk = chunks[c];
+        const Offsets & offset = offsets[c];
+        OBJVertex * vertices = data.vertices.data() + offset.vertices;
+        if (chunks.size() > 1)
         {
-            mesh.V[i] = positions.at(vertices[i].p-1);
-            bbox.enclose(mesh.V[i]);
+            std::copy(chunk.positions.begin(), chunk.positions.end(), data.positions.begin() + offset.positions);
+            std::copy(chunk.texcoords.begin(), chunk.texcoords.end(), data.texcoords.begin() + offset.texcoords);
+            std::copy(chunk.normals.begin(), chunk.normals.end(), data.normals.begin() + offset.normals);
+            std::copy(chunk.vertices.begin(), chunk.vertices.end(), vertices);
+            chunk = OBJData();
         }
 
-        if (!normals.empty())
+        for (size_t i = 0; i < offsets[c + 1].vertices - offset.vertices; ++i)
         {
-            mesh.N.resize(vertices.size());
-            for (auto i : range(int(vertices.size())))
-                mesh.N[i] = normals.at(vertices[i].n-1);
+            vertices[i].p = resolveIndex(vertices[i].p, offset.positions);
+            vertices[i].uv = resolveIndex(vertices[i].uv, offset.texcoords);
+            vertices[i].n = resolveIndex(vertices[i].n, offset.normals);
+        }
+    });
+
+    return data;
+}
+
+/**
+    Convert the triangle corners into an indexed vertex list.
+
+    Each distinct OBJVertex becomes one mesh vertex, numbered in the order
+    of its first appearance, exactly like inserting the corners into a
+    single hash map one after the other would. To do this in parallel, the
+    corners are first distributed over one bucket per thread by their hash
+    (keeping their order within each bucket). Each thread then finds the
+    first corner of every distinct vertex of its bucket with its own hash
+    map, and finally the distinct vertices are numbered with a prefix sum.
+
+    \param corners     The corners of all triangles
+    \param vertices    Receives the distinct OBJ vertices
+    \return            The mesh vertex of each corner
+ */
+vector<uint32_t> deduplicate(const vector<OBJVertex> & corners, vector<OBJVertex> & vertices,
+                             int numThreads)
+{
+    typedef std::unordered_map<OBJVertex, uint32_t, OBJVertexHash> VertexMap;
+
+    size_t n = corners.size();
+    int numChunks = n < MinParallelCorners ? 1 : numThreads;
+    int numBuckets = numChunks;
+    auto bucketOf = [numBuckets](const OBJVertex & v)
+    {
+        // mix the bits, since the hash map buckets use the low ones of the same hash
+        return int(((OBJVertexHash()(v) * 0x9E3779B97F4A7C15ull) >> 32) % uint64_t(numBuckets));
+    };
+
+    // distribute the corners over the buckets, counting first and then scattering
+    vector<size_t> counts(numChunks * numBuckets, 0);
+    parallelChunks(0, n, numChunks, [&](int c, size_t from, size_t to)
+    {
+        for (size_t i = from; i < to; ++i)
+            ++counts[c * numBuckets + bucketOf(corners[i])];
+    });
+
+    vector<size_t> starts(numChunks * numBuckets), bucketStarts(numBuckets + 1, 0);
+    size_t start = 0;
+    for (int b = 0; b < numBuckets; ++b)
+    {
+        bucketStarts[b] = start;
+        for (int c = 0; c < numChunks; ++c)
+        {
+            starts[c * numBuckets + b] = start;
+            start += counts[c * numBuckets + b];
         }
+    }
+    bucketStarts[numBuckets] = start;
 
-        if (!texcoords.empty())
+    vector<uint32_t> bucketed(n);
+    parallelChunks(0, n, numChunks, [&](int c, size_t from, size_t to)
+    {
+        size_t * next = &starts[c * numBuckets];
+        for (size_t i = from; i < to; ++i)
+            bucketed[next[bucketOf(corners[i])]++] = uint32_t(i);
+    });
+
+    // find the first corner with the same OBJ vertex as each corner
+    vector<uint32_t> first(n);
+    parallelChunks(0, numBuckets, numBuckets, [&](int b, size_t, size_t)
+    {
+        VertexMap vertexMap;
+        vertexMap.reserve((bucketStarts[b + 1] - bucketStarts[b]) / 4);
+        for (size_t i = bucketStarts[b]; i < bucketStarts[b + 1]; ++i)
         {
-            mesh.UV.resize(vertices.size());
-            for (auto i : range(int(vertices.size())))
-                mesh.UV[i] = texcoords.at(vertices[i].uv-1);
+            uint32_t corner = bucketed[i];
+            first[corner] = vertexMap.emplace(corners[corner], corner).first->second;
+        }
+    });
+    vector<uint32_t>().swap(bucketed);
+
+    // number the distinct vertices in order of their first corner
+    vector<size_t> numNew(numChunks + 1, 0);
+    parallelChunks(0, n, numChunks, [&](int c, size_t from, size_t to)
+    {
+        for (size_t i = from; i < to; ++i)
+            numNew[c + 1] += first[i] == i;
+    });
+    for (int c = 0; c < numChunks; ++c)
+        numNew[c + 1] += numNew[c];
+
+    vector<uint32_t> indices(n);
+    vertices.resize(numNew[numChunks]);
+    parallelChunks(0, n, numChunks, [&](int c, size_t from, size_t to)
+    {
+        uint32_t next = uint32_t(numNew[c]);
+        for (size_t i = from; i < to; ++i)
+            if (first[i] == i)
+            {
+                vertices[next] = corners[i];
+                indices[i] = next++;
+            }
+    });
+    parallelChunks(0, n, numChunks, [&](int c, size_t from, size_t to)
+    {
+        // only write duplicates, whose first corners other chunks may be reading
+        for (size_t i = from; i < to; ++i)
+            if (first[i] != i)
+                indices[i] = indices[first[i]];
+    });
+
+    return indices;
+}
+
+} // namespace
+
+
+Mesh loadWavefrontOBJ(const std::string & filename, const Transform & xform)
+{
+    MemoryMappedFile file(filename);
+
+    message("Loading '%s' ... \n", filename);
+    Timer timer;
+    PhaseTimer phaseTimer(Phase::MeshLoad);
+
+    int numThreads = numWorkerThreads();
+    vector<uint32_t> indices;
+    vector<OBJVertex> vertices;
+
+    Mesh mesh;
+    Box3f bbox;
+
+    {
+        const char * begin = file.data(), * end = begin + file.size();
+
+        // split the file into one chunk of whole lines per thread
+        int numChunks = int(clamp(file.size() / MinChunkSize, size_t(1), size_t(numThreads)));
+        vector<const char *> chunkStarts(numChunks + 1, end);
+        chunkStarts[0] = begin;
+        for (int c = 1; c < numChunks; ++c)
+        {
+            const char * p = std::max(begin + file.size() * c / numChunks, chunkStarts[c - 1]);
+            chunkStarts[c] = p == end ? end : std::min(findLineEnd(p, end) + 1, end);
+        }
+
+        vector<OBJData> chunks(numChunks);
+        {
+            Progress progress("Reading OBJ file", int64_t(file.size()));
+            parallelChunks(0, numChunks, numChunks, [&](int c, size_t, size_t)
+            {
+                reserveByEstimate(chunkStarts[c], chunkStarts[c + 1], chunks[c]);
+                parseOBJ(chunkStarts[c], chunkStarts[c + 1], xform, chunks[c], progress);
+            });
         }
+        OBJData data = mergeChunks(chunks);
+
+        indices = deduplicate(data.vertices, vertices, numThreads);
+        vector<OBJVertex>().swap(data.vertices);
+
+        mesh.F.resize(indices.size()/3);
+        for (auto i : range(int(mesh.F.size())))
+            mesh.F[i] = Vec3i(indices[3*i], indices[3*i+1], indices[3*i+2]);
+
+        auto fetch = [](const auto & array, int32_t index, const char * what)
+        {
+            if (index < 1 || size_t(index) > array.size())
+                throw DirtException("OBJ face references %s %d, but there are only %d.",
+                                    what, index, array.size());
+            return array[index - 1];
+        };
+
+        mesh.V.resize(vertices.size());
+        if (!data.normals.empty())
+            mesh.N.resize(vertices.size());
+        if (!data.texcoords.empty())
+            mesh.UV.resize(vertices.size());
+
+        int numVertexChunks = vertices.size() < MinParallelCorners ? 1 : numThreads;
+        vector<Box3f> chunkBoxes(numVertexChunks);
+        parallelChunks(0, vertices.size(), numVertexChunks, [&](int c, size_t from, size_t to)
+        {
+            for (size_t i = from; i < to; ++i)
+            {
+                mesh.V[i] = fetch(data.positions, vertices[i].p, "vertex");
+                chunkBoxes[c].enclose(mesh.V[i]);
+                if (!mesh.N.empty())
+                    mesh.N[i] = fetch(data.normals, vertices[i].n, "normal");
+                if (!mesh.UV.empty())
+                    mesh.UV[i] = fetch(data.texcoords, vertices[i].uv, "texture coordinate");
+            }
+        });
+        for (const auto & box : chunkBoxes)
+            bbox.enclose(box);
 
     }
 
@@ -250,8 +657,7 @@ Mesh loadWavefrontOBJ(const std::string & filename, const Transform & xform)
 
     debug("done. (V=%d, F=%d, took %s and %s)\n",
             mesh.V.size(), mesh.F.size(), timer.elapsedString(),
-            memString(mesh.F.size() * sizeof(uint32_t) + sizeof(float) *
-                      (mesh.V.size() + mesh.N.size() + mesh.UV.size())));
+            memString(mesh.memoryUsage()));
 
     return mesh;
 }
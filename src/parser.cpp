@@ -17,14 +17,17 @@
 */
 
 #include <dirt/parser.h>
-#include <dirt/obj.h>
+#include <dirt/meshcache.h>
+#include <dirt/instance.h>
 #include <dirt/bbh.h>
 #include <dirt/sphere.h>
 #include <dirt/quad.h>
 #include <dirt/scene.h>
+#include <dirt/stats.h>
 #include <iostream>
 #include <filesystem/resolver.h>
 #include<dirt/integrator.h>
+#include <dirt/wavefront.h>
 
 void from_json(const json & j, Transform & v)
 {
@@ -63,7 +66,7 @@ shared_ptr<SurfaceGroup> parseAccelerator(const Scene & scene, const json & j)
 {
     string type = getKey("type", "accelerator", j);
 
-    if (type == "bbh" || type == "bvh")
+    if (type == "bbh" || type == "bvh" || type == "qbvh" || type == "obvh")
         return make_shared<BBH>(scene, j);
     else if (type == "group")
         return make_shared<SurfaceGroup>(scene, j);
@@ -120,9 +123,11 @@ shared_ptr<Integrator> parseIntegrator(const json& j)
     if (type == "normals")
         return make_shared<NormalIntegrator>();
     if (type == "ao")
-        return make_shared<AmbientOcclusionIntegrator>();
+        return make_shared<AmbientOcclusionIntegrator>(j);
     if (type == "path_tracer_mats")
         return make_shared<PathTracerMaterials>(j);
+    if (type == "path_tracer_wavefront")
+        return make_shared<WavefrontPathTracer>(j);
     else
         throw DirtException("Unknown 'integrator' type '%s' here:\n%s.", type, j.dump(4));
 }
@@ -140,15 +145,18 @@ void parseSurface(const Scene & scene, SurfaceBase * parent, const json & j)
         xform = j.value("transform", xform);
         std::string filename = j["filename"];
 
-        auto mesh = make_shared<Mesh>(loadWavefrontOBJ(getFileResolver().resolve(filename).str(), xform));
+        auto surface = loadTriangleMesh(scene, j, getFileResolver().resolve(filename).str(), xform);
 
-        if (mesh->empty())
-            return;
-
-        mesh->material = scene.findOrCreateMaterial(j);
+        if (surface)
+            parent->addChild(surface);
+    }
+    else if (type == "instance")
+    {
+        std::string filename = getKey("filename", "instance", j);
+        auto prototype = scene.findOrLoadPrototype(j, getFileResolver().resolve(filename).str());
 
-        for (auto index : range(mesh->F.size()))
-            parent->addChild(make_shared<Triangle>(scene, j, mesh, int(index)));
+        if (prototype)
+            parent->addChild(make_shared<Instance>(scene, j, prototype));
     }
     else
         throw DirtException("Unknown surface type '%s' here:\n%s",
@@ -159,6 +167,18 @@ void parseSurface(const Scene & scene, SurfaceBase * parent, const json & j)
 void Scene::parseFromJSON(const json & j)
 {
     message("parsing...\n");
+    PhaseTimer timer(Phase::Parse);
+
+    // leave out what does not change the stored samples: the thread count, and the
+    // sample limits, which a finished render may be resumed with a higher value of
+    json description = j;
+    description.erase("threads");
+    description.erase("image_samples");
+    auto adaptive = description.find("adaptive");
+    if (adaptive != description.end() && adaptive->is_object())
+        adaptive->erase("max_spp");
+    string dump = description.dump();
+    m_descriptionHash = hashBytes(dump.data(), dump.size());
 
     // first create the scene-wide acceleration structure
     if (j.contains("accelerator"))
@@ -190,6 +210,30 @@ void Scene::parseFromJSON(const json & j)
         {
             m_imageSamples = it.value();
         }
+        else if (it.key() == "adaptive")
+        {
+            const json & a = it.value();
+            m_adaptive = true;
+            m_minSamples = a.value("min_spp", m_minSamples);
+            m_maxSamples = a.value("max_spp", m_maxSamples);
+            m_threshold = a.value("threshold", m_threshold);
+            if (m_minSamples < 2)
+                throw DirtException("'min_spp' must be at least 2 here:\n%s.", a.dump(4));
+            if (m_threshold <= 0.f)
+                throw DirtException("'threshold' must be positive here:\n%s.", a.dump(4));
+        }
+        else if (it.key() == "threads")
+        {
+            m_numThreads = it.value();
+        }
+        else if (it.key() == "seed")
+        {
+            m_seed = it.value();
+        }
+        else if (it.key() == "roulette_depth")
+        {
+            m_rouletteDepth = it.value();
+        }
         else if (it.key() == "background")
         {
             m_background = it.value();
@@ -217,6 +261,10 @@ void Scene::parseFromJSON(const json & j)
     if (!m_camera)
         throw DirtException("No camera specified in scene!");
 
+    if (m_adaptive && maxSamples() < m_minSamples)
+        throw DirtException("Adaptive 'max_spp' (%d) must not be less than 'min_spp' (%d).",
+                            maxSamples(), m_minSamples);
+
     m_surfaces->build();
     message("done parsing scene.\n");
 }
\ No newline at end of file
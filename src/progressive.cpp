@@ -0,0 +1,121 @@
+/*
+    This file is part of Dirt, the Dartmouth introductory ray tracer.
+
+    Copyright (c) 2017-2019 by Wojciech Jarosz
+
+    Dirt is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Dirt is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <dirt/progressive.h>
+#include <dirt/binaryfile.h>
+
+namespace
+{
+
+// Bump this whenever the layout of the state file (or of PixelStatistics) changes
+const uint32_t RenderStateVersion = 3;
+
+/// The start of a saved render state, followed by the array of pixel statistics
+struct RenderStateHeader
+{
+    char magic[8];                      ///< "DIRTACC" and a terminating 0
+    uint32_t version;                   ///< RenderStateVersion
+    int32_t width;                      ///< Image width
+    int32_t height;                     ///< Image height
+    int32_t samplesDone;                ///< Samples per pixel traced so far
+    uint64_t seed;                      ///< Scene::seed() of the rendered scene
+    uint64_t descriptionHash;           ///< Scene::descriptionHash() of the rendered scene
+};
+
+static_assert(sizeof(RenderStateHeader) == 40, "RenderStateHeader should not contain padding");
+
+} // namespace
+
+
+ProgressiveRender::ProgressiveRender(const Scene & scene) :
+    m_scene(scene), m_pixels(scene.camera()->resolution().x, scene.camera()->resolution().y)
+{
+
+}
+
+void ProgressiveRender::renderPass(int samples)
+{
+    int end = std::min(m_samplesDone + samples, m_scene.maxSamples());
+    m_scene.renderSamples(m_pixels, m_samplesDone, end);
+    m_samplesDone = std::max(m_samplesDone, end);
+}
+
+Image3f ProgressiveRender::image() const
+{
+    Image3f image(m_pixels.width(), m_pixels.height());
+    for (auto i : range(m_pixels.size()))
+        image(i) = m_pixels(i).mean;
+    return image;
+}
+
+void ProgressiveRender::save(const string & filename) const
+{
+    RenderStateHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "DIRTACC", 8);
+    header.version = RenderStateVersion;
+    header.width = m_pixels.width();
+    header.height = m_pixels.height();
+    header.samplesDone = m_samplesDone;
+    header.seed = m_scene.seed();
+    header.descriptionHash = m_scene.descriptionHash();
+
+    vector<PixelStatistics> pixels(m_pixels.size());
+    for (auto i : range(m_pixels.size()))
+        pixels[i] = m_pixels(i);
+
+    string tempFile = filename + ".tmp";
+    {
+        BinaryWriter writer(tempFile);
+        writer.write(header);
+        writer.write(pixels);
+        writer.close();
+    }
+    replaceFile(tempFile, filename);
+}
+
+void ProgressiveRender::load(const string & filename)
+{
+    MemoryMappedFile file(filename);
+    BinaryReader reader(file.data(), file.size());
+
+    auto header = reader.read<RenderStateHeader>();
+    if (std::memcmp(header.magic, "DIRTACC", 8) != 0 || header.version != RenderStateVersion)
+        throw DirtException("'%s' is not a render state of this version of dirt.", filename);
+    if (header.width != m_pixels.width() || header.height != m_pixels.height())
+        throw DirtException("Render state '%s' is %dx%d, but the camera renders %dx%d pixels.", filename,
+                            header.width, header.height, m_pixels.width(), m_pixels.height());
+
+    // continuing with different random numbers or a different scene would silently mix two renders;
+    // only the sample limits may change, since more samples never alter the ones already taken
+    if (header.seed != m_scene.seed())
+        throw DirtException("Render state '%s' was rendered with seed %d, but the scene uses seed %d.",
+                            filename, header.seed, m_scene.seed());
+    if (header.descriptionHash != m_scene.descriptionHash())
+        throw DirtException("Render state '%s' was rendered from a different scene description "
+                            "(only \"image_samples\" and the adaptive \"max_spp\" may change).", filename);
+
+    vector<PixelStatistics> pixels;
+    reader.read(pixels);
+    if (int(pixels.size()) != m_pixels.size() || header.samplesDone < 0)
+        throw DirtException("Render state '%s' is damaged.", filename);
+
+    for (auto i : range(m_pixels.size()))
+        m_pixels(i) = pixels[i];
+    m_samplesDone = header.samplesDone;
+}
@@ -18,6 +18,7 @@
 
 #include <dirt/quad.h>
 #include <dirt/scene.h>
+#include <dirt/stats.h>
 
 Quad::Quad(const Vec2f & size,
            shared_ptr<const Material> material,
@@ -36,34 +37,59 @@ Quad::Quad(const Scene & scene, const json & j)
     m_material = scene.findOrCreateMaterial(j);
 }
 
-bool Quad::intersect(const Ray3f &ray, HitInfo &hit) const
+bool Quad::closestHit(const Ray3f &ray, HitInfo &hit) const
 {
-    INCREMENT_INTERSECTION_TESTS;
+    DIRT_STAT(PrimitiveTests);
 
-    // compute ray intersection (and ray parameter), continue if not hit
-    auto tray = m_xform.inverse().ray(ray);
-    if (tray.d.z == 0)
+    float t;
+    Vec3f p;
+    if (!localHit(m_toLocal.ray(ray), t, p))
         return false;
-    auto t = -tray.o.z / tray.d.z;
-    auto p = tray(t);
 
-    if (m_size.x < p.x || -m_size.x > p.x || m_size.y < p.y || -m_size.y > p.y)
-        return false;
+    hit.t = t;
+    hit.surface = this;
+    return true;
+}
 
-    // check if computed param is within ray.mint and ray.maxt
-    if (t < tray.mint || t > tray.maxt)
-        return false;
+void Quad::computeSurfaceInteraction(const Ray3f &ray, HitInfo &hit) const
+{
+    float t = hit.t;
+    Vec3f p = m_toLocal.ray(ray)(t);
 
 	// project hitpoint onto plane to reduce floating-point error
 	p.z = 0;
 
-    Vec3f gn = normalize(m_xform.normal({0,0,1}));
+    Vec3f gn = normalize(m_toWorld.normal({0,0,1}));
     // if hit, set intersection record values
-    hit = HitInfo(t, m_xform.point(p), gn, gn,
+    hit = HitInfo(t, m_toWorld.point(p), gn, gn,
                          Vec2f((p.x+m_size.x)/ (2*m_size.x), 
         (p.y + m_size.y) / (2 * m_size.y)), /* TODO: Compute proper UV coordinates */
                          m_material.get(), this);
-    return true;
+}
+
+
+bool Quad::occluded(const Ray3f &ray) const
+{
+    DIRT_STAT(PrimitiveTests);
+
+    float t;
+    Vec3f p;
+    return localHit(m_toLocal.ray(ray), t, p);
+}
+
+bool Quad::localHit(const Ray3f &tray, float &t, Vec3f &p) const
+{
+    // compute ray intersection (and ray parameter), continue if not hit
+    if (tray.d.z == 0)
+        return false;
+    t = -tray.o.z / tray.d.z;
+    p = tray(t);
+
+    if (m_size.x < p.x || -m_size.x > p.x || m_size.y < p.y || -m_size.y > p.y)
+        return false;
+
+    // check if computed param is within ray.mint and ray.maxt
+    return t >= tray.mint && t <= tray.maxt;
 }
 
 
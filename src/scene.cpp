@@ -17,8 +17,12 @@
 */
 
 #include <dirt/scene.h>
+#include <dirt/meshcache.h>
 #include <dirt/progress.h>
 #include <fstream>
+#include <atomic>
+#include <mutex>
+#include <thread>
 #include<dirt/integrator.h>
 
 /// Construct a new scene from a json object
@@ -72,65 +76,242 @@ shared_ptr<const Material> Scene::findOrCreateMaterial(const json & jp, const st
         throw DirtException("Type mismatch: Expecting either a material or material name here:\n%s", jp.dump(4));
 }
 
+shared_ptr<const TriangleMesh> Scene::findOrLoadPrototype(const json & j, const string & filename) const
+{
+    string key = filename + "\n" + j.value("accelerator", json::object()).dump();
+    auto i = m_prototypes.find(key);
+    if (i != m_prototypes.end())
+        return i->second;
+
+    shared_ptr<const TriangleMesh> prototype = loadTriangleMesh(*this, j, filename, Transform());
+    m_prototypes[key] = prototype;
+    return prototype;
+}
+
 // compute the color corresponding to a ray by raytracing
-Color3f Scene::recursiveColor(const Ray3f &ray, int depth) const
+Color3f Scene::recursiveColor(const Ray3f &ray, Sampler &sampler, int depth) const
 {
     HitInfo hit;
+    bool hitSomething = this->intersect(ray, hit);
+    return recursiveColor(ray, hitSomething ? &hit : nullptr, sampler, depth);
+}
+
+Color3f Scene::recursiveColor(const Ray3f &ray, const HitInfo * hitp, Sampler &sampler, int depth) const
+{
     const int MaxDepth = 64;
-    if (this->intersect(ray, hit))
+
+    // follow the path forward, weighting what it finds by the product of the attenuations so far
+    Color3f color(0.f), throughput(1.f);
+    Ray3f current = ray;
+    HitInfo hit;
+    bool hitSomething = hitp != nullptr;
+    if (hitp)
+        hit = *hitp;
+
+    for (;; ++depth)
     {
+        if (!hitSomething)
+            return color + throughput * m_background;
+
+        color += throughput * hit.mat->emitted(current, hit);
+
         Ray3f scattered;
         Vec3f attenuation;
-        Color3f emit = hit.mat->emitted(ray, hit);
+        if (depth >= MaxDepth || !hit.mat->scatter(current, hit, attenuation, scattered, sampler))
+            return color;
 
-        //const Ray3f& ray, const HitInfo& hit, Color3f& attenuation, Ray3f& scattered
-        if (depth < MaxDepth && hit.mat->scatter(ray, hit, attenuation, scattered)) {
-            return emit+attenuation * this->recursiveColor(scattered, depth + 1);
-        }
-        else return emit;
+        throughput *= attenuation;
+        if (depth >= m_rouletteDepth && !russianRoulette(throughput, sampler))
+            return color;
+
+        current = scattered;
+        hitSomething = intersect(current, hit);
     }
-    else return m_background;
 }
 
 // raytrace an image
 Image3f Scene::raytrace() const
 {
+    Array2d<PixelStatistics> pixels(m_camera->resolution().x, m_camera->resolution().y);
+    renderSamples(pixels, 0, maxSamples());
+
     // allocate an image of the proper size
-    auto image = Image3f(m_camera->resolution().x, m_camera->resolution().y);
+    auto image = Image3f(pixels.width(), pixels.height());
+    uint64_t numSamples = 0;
+    for (auto i : range(pixels.size()))
+    {
+        image(i) = pixels(i).mean;
+        numSamples += pixels(i).count;
+    }
+
+    if (m_adaptive)
+        message("Adaptive sampling took %.2f samples per pixel on average.\n",
+                double(numSamples) / double(max(pixels.size(), 1)));
+
+	// return the ray-traced image
+    return image;
+}
+
+int Scene::maxSamples() const
+{
+    return m_adaptive && m_maxSamples > 0 ? m_maxSamples : m_imageSamples;
+}
+
+bool Scene::converged(const PixelStatistics & pixel) const
+{
+    // below this, the error is measured relative to a luminance that is barely visible on a display
+    const float MinLuminance = 1.f / 256.f;
+
+    return m_adaptive && pixel.count >= m_minSamples &&
+           pixel.standardError() <= m_threshold * std::max(luminance(pixel.mean), MinLuminance);
+}
+
+void Scene::renderSamples(Array2d<PixelStatistics> & pixelStats, int firstSample, int lastSample) const
+{
+    if (pixelStats.width() != m_camera->resolution().x || pixelStats.height() != m_camera->resolution().y)
+        throw DirtException("Pixel statistics of size %dx%d do not match the camera resolution.",
+                            pixelStats.width(), pixelStats.height());
+
+    // The image is split into square tiles which are handed out to the render
+    // threads on demand. Every pixel sample draws from its own random number
+    // stream, so the result does not depend on the number of threads or on
+    // the order in which tiles are rendered.
+    const int tileSize = 32;
+    // Within a tile, the camera rays of blocks of packetSize x packetSize
+    // pixels are traced together as one RayPacket. The paths of all pixels
+    // of a tile are then handed to the integrator as one batch per sample.
+    const int packetSize = 4;
+    static_assert(packetSize * packetSize <= RayPacket::MaxSize, "packet too small for a pixel block");
+    const int tilesX = (pixelStats.width() + tileSize - 1) / tileSize;
+    const int tilesY = (pixelStats.height() + tileSize - 1) / tileSize;
+    const int numTiles = tilesX * tilesY;
+    if (numTiles == 0 || firstSample >= lastSample)
+        return;
+
+    int numThreads = m_numThreads > 0 ? m_numThreads : int(std::thread::hardware_concurrency());
+    numThreads = clamp(numThreads, 1, numTiles);
+
+    PhaseTimer renderTimer(Phase::Render);
+    Progress progress("Rendering", pixelStats.size());
+
+    std::atomic<int> nextTile(0);
+    std::exception_ptr failure;
+    std::mutex failureMutex;
+    // how long each thread was busy before it ran out of tiles
+    vector<double> busyTimes(numThreads, 0.0);
 
-   
-    // Hint: you can create a Progress object (progress.h) to provide a 
-    // progress bar during rendering.
+    auto renderTiles = [&](int thread)
     {
-        Progress progress("Rendering", image.size());
-        // Generate a ray for each pixel in the ray image
-        for (auto y : range(image.height()))
+        Timer busyTimer;
+
+        // the pixels of the tile being rendered, with the pixels of each
+        // packetSize x packetSize block stored consecutively
+        const int maxPixels = tileSize * tileSize;
+        vector<Vec2i> pixels(maxPixels);
+        vector<int> blockStarts;
+
+        // the paths of the current sample, one per pixel still being sampled
+        vector<int> pathPixels(maxPixels);
+        vector<Sampler> samplers(maxPixels, Sampler(m_seed));
+        vector<Ray3f> rays(maxPixels);
+        vector<HitInfo> hits(maxPixels);
+        vector<const HitInfo *> hitPointers(maxPixels);
+        vector<Color3f> sampleColors(maxPixels);
+
+        try
         {
-            for (auto x : range(image.width()))
+            for (int tile = nextTile++; tile < numTiles; tile = nextTile++)
             {
-                INCREMENT_TRACED_RAYS;
-                
-                Color3f color = Color3f(0.0f);
+                int x0 = (tile % tilesX) * tileSize;
+                int y0 = (tile / tilesX) * tileSize;
+                int x1 = min(x0 + tileSize, pixelStats.width());
+                int y1 = min(y0 + tileSize, pixelStats.height());
 
-                // TODO: Call recursiveColorFunction ``NumSamples'' times and average the
-                // results. Assign the average color to ``color''
-                for (auto i = 0; i < m_imageSamples; i++)
+                int numPixels = 0;
+                blockStarts.clear();
+                for (int by = y0; by < y1; by += packetSize)
+                    for (int bx = x0; bx < x1; bx += packetSize)
+                    {
+                        blockStarts.push_back(numPixels);
+                        for (auto y : range(by, min(by + packetSize, y1)))
+                            for (auto x : range(bx, min(bx + packetSize, x1)))
+                                pixels[numPixels++] = Vec2i(x, y);
+                    }
+                blockStarts.push_back(numPixels);
+
+                // add jittered samples to the pixels until they are done
+                for (auto i = firstSample; i < lastSample; i++)
                 {
-                    auto ray = m_camera->generateRay(x + randf(), y + randf());
+                    int numPaths = 0;
+                    for (auto b : range(int(blockStarts.size()) - 1))
+                    {
+                        RayPacket packet;
+                        int first = numPaths;
+                        for (auto k : range(blockStarts[b], blockStarts[b + 1]))
+                        {
+                            const PixelStatistics & stats = pixelStats(pixels[k].x, pixels[k].y);
+                            if (stats.count > i || converged(stats))
+                                continue;
+
+                            int p = numPaths++;
+                            pathPixels[p] = k;
+                            samplers[p].startPixelSample(pixels[k], i);
+                            Vec2f jitter = samplers[p].next2D();
+                            rays[p] = m_camera->generateRay(pixels[k].x + jitter.x,
+                                                            pixels[k].y + jitter.y);
+                            packet.add(rays[p]);
+                        }
+                        if (packet.size == 0)
+                            continue;
+                        DIRT_RAY_STAT_ADD(CameraRays, packet.size);
+
+                        uint32_t hitMask = intersect(packet, &hits[first]);
+                        for (auto k : range(packet.size))
+                            hitPointers[first + k] = (hitMask & (1u << k)) ? &hits[first + k] : nullptr;
+                    }
+                    if (numPaths == 0)
+                        break;
+
+                    // each sampler resumes its pixel sample's random stream after the jitter
                     if (m_integrator != nullptr)
+                        m_integrator->shadeBatch(*this, numPaths, samplers.data(), rays.data(),
+                                                 hitPointers.data(), sampleColors.data());
+                    else
+                        for (auto p : range(numPaths))
+                            sampleColors[p] = recursiveColor(rays[p], hitPointers[p], samplers[p], 0);
+
+                    for (auto p : range(numPaths))
                     {
-                        color += m_integrator->Li(*this,ray);//recursiveColor(ray, 0);
+                        const Vec2i & pixel = pixels[pathPixels[p]];
+                        pixelStats(pixel.x, pixel.y).add(sampleColors[p]);
                     }
-                    else color += recursiveColor(ray, 0);
                 }
-                color /= m_imageSamples;
-                image(x, y) = color;
-                ++progress;
+
+                progress += (x1 - x0) * (y1 - y0);
             }
         }
-    }
+        catch (...)
+        {
+            // stop handing out work and remember the first error
+            nextTile = numTiles;
+            std::lock_guard<std::mutex> lock(failureMutex);
+            if (!failure)
+                failure = std::current_exception();
+        }
 
-	// return the ray-traced image
-    return image;
-}
+        // merge this thread's statistics into the totals for the frame
+        busyTimes[thread] = busyTimer.elapsed();
+        flushThreadStats();
+    };
+
+    vector<std::thread> threads;
+    for (auto i : range(numThreads - 1))
+        threads.emplace_back(renderTiles, i + 1);
+    renderTiles(0);
+    for (auto & t : threads)
+        t.join();
+    addRenderThreadTimes(busyTimes, renderTimer.elapsed());
 
+    if (failure)
+        std::rethrow_exception(failure);
+}
@@ -18,6 +18,7 @@
 
 #include <dirt/sphere.h>
 #include <dirt/scene.h>
+#include <dirt/stats.h>
 
 
 Sphere::Sphere(float radius,
@@ -42,38 +43,34 @@ Box3f Sphere::localBBox() const
 
 
 
-bool Sphere::intersect(const Ray3f &ray, HitInfo &hit) const
+bool Sphere::closestHit(const Ray3f &ray, HitInfo &hit) const
 {
-    INCREMENT_INTERSECTION_TESTS;
+    DIRT_STAT(PrimitiveTests);
     // TODO: Assignment 1: Implement ray-sphere intersection
 
     //putYourCodeHere("Assignment 1: Insert your ray-sphere intersection code here");
 
     //return false;
-    Ray3f transed_ray = m_xform.inverse().ray(ray);
-    //Vec3f center=m_xform.point(Vec3f(0.f,0.f,0.f));
-    Vec3f CO = transed_ray.o;
-    float A = dot(transed_ray.d, transed_ray.d);
-    float B = 2.f * dot(transed_ray.d , CO);
-    float C = dot(CO, CO) - m_radius * m_radius;
+    float t;
+    if (!localHit(m_toLocal.ray(ray), t))
+        return false;
+
+    // the hit point and normal are only computed for the final hit,
+    // in computeSurfaceInteraction()
+    hit.t = t;
+    hit.surface = this;
+    return true;
+}
 
-    float det = B*B-4*A*C;
-    if (det < 0)return false;
-    det = sqrt(det);
-    float t = (-B - det) / (2 * A);
-    if (t < ray.mint||t>ray.maxt)
-    {
-        t = (-B + det) / (2 * A);
-        if (t < ray.mint || t>ray.maxt)return false;
-    }
-    
-    // TODO: If the ray misses the sphere, you should return false
+void Sphere::computeSurfaceInteraction(const Ray3f &ray, HitInfo &hit) const
+{
     // TODO: If you successfully hit something, you should compute the hit point, 
     //       hit distance, and normal and fill in these values
-    auto transed_hitpoint = transed_ray.o + t * transed_ray.d;
-    float hitT = t;
-    Vec3f hitPoint= m_xform.point(transed_hitpoint);
-    Vec3f geometricNormal= normalize(m_xform.normal(normalize(transed_hitpoint)));
+    Ray3f transed_ray = m_toLocal.ray(ray);
+    auto transed_hitpoint = transed_ray(hit.t);
+    float hitT = hit.t;
+    Vec3f hitPoint= m_toWorld.point(transed_hitpoint);
+    Vec3f geometricNormal= normalize(m_toWorld.normal(normalize(transed_hitpoint)));
 
 
     // For this assignment you can leave these values as is
@@ -84,7 +81,6 @@ bool Sphere::intersect(const Ray3f &ray, HitInfo &hit) const
     float v = (theta) / M_PI;
     Vec2f uvCoordinates = Vec2f(u,v);
 
-    // You should only assign hit and return true if you successfully hit something
     hit = HitInfo(hitT,
             hitPoint,
             geometricNormal,
@@ -92,7 +88,32 @@ bool Sphere::intersect(const Ray3f &ray, HitInfo &hit) const
             uvCoordinates,
             m_material.get(),
             this);
+}
 
-    return true;
+bool Sphere::occluded(const Ray3f &ray) const
+{
+    DIRT_STAT(PrimitiveTests);
 
+    float t;
+    return localHit(m_toLocal.ray(ray), t);
+}
+
+bool Sphere::localHit(const Ray3f &transed_ray, float &t) const
+{
+    //Vec3f center=m_xform.point(Vec3f(0.f,0.f,0.f));
+    Vec3f CO = transed_ray.o;
+    float A = dot(transed_ray.d, transed_ray.d);
+    float B = 2.f * dot(transed_ray.d , CO);
+    float C = dot(CO, CO) - m_radius * m_radius;
+
+    float det = B*B-4*A*C;
+    if (det < 0)return false;
+    det = sqrt(det);
+    t = (-B - det) / (2 * A);
+    if (t < transed_ray.mint||t>transed_ray.maxt)
+    {
+        t = (-B + det) / (2 * A);
+        if (t < transed_ray.mint || t>transed_ray.maxt)return false;
+    }
+    return true;
 }
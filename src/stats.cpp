@@ -0,0 +1,233 @@
+/*
+    This file is part of Dirt, the Dartmouth introductory ray tracer.
+
+    Copyright (c) 2017-2019 by Wojciech Jarosz
+
+    Dirt is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Dirt is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <dirt/stats.h>
+#include <dirt/parser.h>
+#include <fstream>
+#include <mutex>
+
+thread_local uint64_t g_threadStats[int(Stat::Count)] = {};
+
+namespace
+{
+
+std::mutex g_totalsMutex;
+StatCounters g_totals;
+double g_phaseTimes[int(Phase::Count)] = {};
+size_t g_memoryUsage[int(MemoryCategory::Count)] = {};
+vector<double> g_threadBusy;
+double g_renderWall = 0.0;
+
+/// Turn a human-readable name into a JSON key, e.g. "BBH nodes visited" into "bbh_nodes_visited"
+string jsonKey(const char * name)
+{
+    string key(name);
+    for (auto & c : key)
+        c = c == ' ' ? '_' : char(std::tolower(c));
+    return key;
+}
+
+/// Rays per second during rendering
+double raysPerSecond(uint64_t rays)
+{
+    double seconds = g_phaseTimes[int(Phase::Render)] / 1000.0;
+    return seconds > 0.0 ? double(rays) / seconds : 0.0;
+}
+
+/// The number of primary, secondary and shadow rays in \a stats
+void rayCounts(const StatCounters & stats, uint64_t & primary, uint64_t & secondary, uint64_t & shadow)
+{
+    primary = stats[Stat::CameraRays];
+    secondary = stats[Stat::Rays] > primary ? stats[Stat::Rays] - primary : 0;
+    shadow = stats[Stat::ShadowRays];
+}
+
+} // namespace
+
+
+const char * statName(Stat stat)
+{
+    switch (stat)
+    {
+        case Stat::CameraRays:              return "camera rays";
+        case Stat::Rays:                    return "rays";
+        case Stat::ShadowRays:              return "shadow rays";
+        case Stat::NodesVisited:            return "BBH nodes visited";
+        case Stat::BoxTests:                return "box tests";
+        case Stat::PrimitiveTests:          return "primitive tests";
+        case Stat::RouletteTerminations:    return "roulette terminations";
+        default:                            return "unknown";
+    }
+}
+
+void flushThreadStats()
+{
+    std::lock_guard<std::mutex> lock(g_totalsMutex);
+    for (int i = 0; i < int(Stat::Count); ++i)
+    {
+        g_totals.counts[i] += g_threadStats[i];
+        g_threadStats[i] = 0;
+    }
+}
+
+StatCounters statTotals()
+{
+    flushThreadStats();
+    std::lock_guard<std::mutex> lock(g_totalsMutex);
+    return g_totals;
+}
+
+void resetStats()
+{
+    std::lock_guard<std::mutex> lock(g_totalsMutex);
+    g_totals = StatCounters();
+    for (auto & count : g_threadStats)
+        count = 0;
+    for (auto & time : g_phaseTimes)
+        time = 0.0;
+    for (auto & bytes : g_memoryUsage)
+        bytes = 0;
+    g_threadBusy.clear();
+    g_renderWall = 0.0;
+}
+
+const char * phaseName(Phase phase)
+{
+    switch (phase)
+    {
+        case Phase::Parse:                  return "parse";
+        case Phase::MeshLoad:               return "mesh loading";
+        case Phase::BBHBuild:               return "BBH build";
+        case Phase::Render:                 return "render";
+        default:                            return "unknown";
+    }
+}
+
+void addPhaseTime(Phase phase, double ms)
+{
+    std::lock_guard<std::mutex> lock(g_totalsMutex);
+    g_phaseTimes[int(phase)] += ms;
+}
+
+const char * memoryCategoryName(MemoryCategory category)
+{
+    switch (category)
+    {
+        case MemoryCategory::Meshes:        return "meshes";
+        case MemoryCategory::BBH:           return "BBH";
+        default:                            return "unknown";
+    }
+}
+
+void addMemoryUsage(MemoryCategory category, size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(g_totalsMutex);
+    g_memoryUsage[int(category)] += bytes;
+}
+
+void addRenderThreadTimes(const vector<double> & busy, double wall)
+{
+    std::lock_guard<std::mutex> lock(g_totalsMutex);
+    if (g_threadBusy.size() < busy.size())
+        g_threadBusy.resize(busy.size(), 0.0);
+    for (auto i : range(busy.size()))
+        g_threadBusy[i] += busy[i];
+    g_renderWall += wall;
+}
+
+void printStatsReport()
+{
+    auto stats = statTotals();
+    std::lock_guard<std::mutex> lock(g_totalsMutex);
+
+    message("Statistics:\n");
+    message("  Timings:\n");
+    for (int i = 0; i < int(Phase::Count); ++i)
+        message("    %-24s %s\n", phaseName(Phase(i)), timeString(g_phaseTimes[i]));
+
+    uint64_t primary, secondary, shadow;
+    rayCounts(stats, primary, secondary, shadow);
+    message("  Rays:\n");
+    message("    %-24s %d (%.3f M/s)\n", "primary", primary, raysPerSecond(primary) / 1e6);
+    message("    %-24s %d (%.3f M/s)\n", "secondary", secondary, raysPerSecond(secondary) / 1e6);
+    message("    %-24s %d (%.3f M/s)\n", "shadow", shadow, raysPerSecond(shadow) / 1e6);
+
+    message("  Memory:\n");
+    for (int i = 0; i < int(MemoryCategory::Count); ++i)
+        message("    %-24s %s\n", memoryCategoryName(MemoryCategory(i)), memString(g_memoryUsage[i]));
+
+    if (g_renderWall > 0.0)
+    {
+        message("  Render thread utilization:\n");
+        for (auto i : range(g_threadBusy.size()))
+            message("    thread %-17d %.1f%%\n", i, 100.0 * g_threadBusy[i] / g_renderWall);
+    }
+
+#if DIRT_STATS
+    message("  Counters:\n");
+    for (int i = 0; i < int(Stat::Count); ++i)
+        message("    %-24s %d\n", statName(Stat(i)), stats.counts[i]);
+    double rays = double(stats[Stat::Rays] + stats[Stat::ShadowRays]);
+    if (rays > 0.0)
+    {
+        message("    %-24s %.2f\n", "nodes visited per ray", stats[Stat::NodesVisited] / rays);
+        message("    %-24s %.2f\n", "box tests per ray", stats[Stat::BoxTests] / rays);
+        message("    %-24s %.2f\n", "primitive tests per ray", stats[Stat::PrimitiveTests] / rays);
+    }
+#endif
+}
+
+void writeStatsReport(const string & filename)
+{
+    auto stats = statTotals();
+    std::lock_guard<std::mutex> lock(g_totalsMutex);
+
+    json j;
+    for (int i = 0; i < int(Phase::Count); ++i)
+        j["time_ms"][jsonKey(phaseName(Phase(i)))] = g_phaseTimes[i];
+
+    uint64_t primary, secondary, shadow;
+    rayCounts(stats, primary, secondary, shadow);
+    j["rays"]["primary"] = primary;
+    j["rays"]["secondary"] = secondary;
+    j["rays"]["shadow"] = shadow;
+    j["rays_per_second"]["primary"] = raysPerSecond(primary);
+    j["rays_per_second"]["secondary"] = raysPerSecond(secondary);
+    j["rays_per_second"]["shadow"] = raysPerSecond(shadow);
+
+    for (int i = 0; i < int(MemoryCategory::Count); ++i)
+        j["memory_bytes"][jsonKey(memoryCategoryName(MemoryCategory(i)))] = g_memoryUsage[i];
+
+    j["render_threads"] = json::array();
+    for (auto busy : g_threadBusy)
+    {
+        json thread = {{"busy_ms", busy},
+                       {"utilization", g_renderWall > 0.0 ? busy / g_renderWall : 0.0}};
+        j["render_threads"].push_back(thread);
+    }
+
+#if DIRT_STATS
+    for (int i = 0; i < int(Stat::Count); ++i)
+        j["counters"][jsonKey(statName(Stat(i)))] = stats.counts[i];
+#endif
+
+    std::ofstream file(filename);
+    if (!file.good())
+        throw DirtException("Cannot write statistics to '%s'.", filename);
+    file << j.dump(4) << std::endl;
+}
@@ -22,6 +22,8 @@
 Surface::Surface(const Scene & scene, const json & j)
 {
 	m_xform = j.value("transform", m_xform);
+    m_toWorld = FastTransform(m_xform);
+    m_toLocal = FastTransform(m_xform.inverse());
 }
 
 Box3f Surface::worldBBox() const
@@ -37,10 +37,15 @@ void SurfaceGroup::clear()
     m_surfaces.shrink_to_fit();
 }
 
-bool SurfaceGroup::intersect(const Ray3f &_ray, HitInfo &hit) const
+bool SurfaceGroup::closestHit(const Ray3f &ray, HitInfo &hit) const
 {
-    // copy the ray so we can modify the tmax values as we traverse
-    Ray3f ray = _ray;
+    return closestHit(RayQuery3f(ray), hit);
+}
+
+bool SurfaceGroup::closestHit(const RayQuery3f &_query, HitInfo &hit) const
+{
+    // copy the query so we can modify the tmax values as we traverse
+    RayQuery3f query = _query;
     bool hitSomething = false;
     
     // This is a linear intersection test that iterates over all primitives
@@ -48,15 +53,30 @@ bool SurfaceGroup::intersect(const Ray3f &_ray, HitInfo &hit) const
     // slow if you have many primitives.
 
     // foreach primitive
-    for (auto surface : m_surfaces)
+    for (const auto & surface : m_surfaces)
     {
-        if (surface->intersect(ray, hit))
+        if (surface->closestHit(query, hit))
         {
             hitSomething = true;
-            ray.maxt = hit.t;
+            query.ray.maxt = hit.t;
         }
     }
 
     // record closest intersection
     return hitSomething;
 }
+
+bool SurfaceGroup::occluded(const Ray3f &ray) const
+{
+    return occluded(RayQuery3f(ray));
+}
+
+bool SurfaceGroup::occluded(const RayQuery3f &query) const
+{
+    // any hit will do, so stop at the first one
+    for (const auto & surface : m_surfaces)
+        if (surface->occluded(query))
+            return true;
+
+    return false;
+}
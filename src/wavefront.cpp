@@ -0,0 +1,155 @@
+/*
+    This file is part of Dirt, the Dartmouth introductory ray tracer.
+
+    Copyright (c) 2017-2019 by Wojciech Jarosz
+
+    Dirt is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Dirt is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <dirt/wavefront.h>
+#include <algorithm>
+
+namespace
+{
+
+/**
+    The state of a batch of paths, as one array per quantity.
+
+    Path k keeps index k in every array for its whole life; only the list
+    of active path indices is reordered and compacted.
+ */
+struct PathQueue
+{
+    vector<Ray3f> rays;                 ///< The ray leaving each path's last vertex
+    vector<HitInfo> hits;               ///< The closest hit of each ray
+    vector<uint8_t> found;              ///< Whether each ray hit anything
+    vector<Color3f> throughput;         ///< Product of the path's weights so far
+    vector<int> active;                 ///< Indices of the paths still being traced
+
+    explicit PathQueue(int count)
+        : rays(count), hits(count), found(count), throughput(count, Color3f(1.f)), active(count)
+    {
+        for (int k = 0; k < count; ++k)
+            active[k] = k;
+    }
+
+    /// Find the closest hits of the rays of all active paths, in packets
+    void intersect(const Scene & scene)
+    {
+        HitInfo packetHits[RayPacket::MaxSize];
+        for (size_t b = 0; b < active.size(); b += RayPacket::MaxSize)
+        {
+            RayPacket packet;
+            size_t end = std::min(active.size(), b + RayPacket::MaxSize);
+            for (size_t i = b; i < end; ++i)
+                packet.add(rays[active[i]]);
+
+            uint32_t hitMask = scene.intersect(packet, packetHits);
+            for (int i = 0; i < packet.size; ++i)
+            {
+                int k = active[b + i];
+                found[k] = (hitMask >> i) & 1u;
+                if (found[k])
+                    hits[k] = packetHits[i];
+            }
+        }
+    }
+
+    /// The material of the surface path \a k hit, or nullptr for escaped paths
+    const Material * material(int k) const {return found[k] ? hits[k].mat : nullptr;}
+};
+
+} // namespace
+
+
+WavefrontPathTracer::WavefrontPathTracer(const json & j)
+{
+    m_maxBounces = j.at("max_bounces");
+    m_rouletteDepth = j.value("roulette_depth", 5);
+}
+
+Color3f WavefrontPathTracer::shade(const Scene & scene, Sampler & sampler, const Ray3f & ray,
+                                   const HitInfo * hit, int depth) const
+{
+    Color3f color;
+    trace(scene, 1, &sampler, &ray, &hit, &color, depth);
+    return color;
+}
+
+void WavefrontPathTracer::shadeBatch(const Scene & scene, int count, Sampler samplers[], const Ray3f rays[],
+                                     const HitInfo * const hits[], Color3f colors[]) const
+{
+    trace(scene, count, samplers, rays, hits, colors, 0);
+}
+
+void WavefrontPathTracer::trace(const Scene & scene, int count, Sampler samplers[], const Ray3f rays[],
+                                const HitInfo * const hits[], Color3f colors[], int depth) const
+{
+    PathQueue paths(count);
+    for (int k = 0; k < count; ++k)
+    {
+        colors[k] = Color3f(0.f);
+        paths.rays[k] = rays[k];
+        paths.found[k] = hits[k] != nullptr;
+        if (hits[k])
+            paths.hits[k] = *hits[k];
+    }
+
+    for (bool first = true; !paths.active.empty(); first = false, ++depth)
+    {
+        // the closest hits of the first rays are given
+        if (!first)
+            paths.intersect(scene);
+
+        // group the paths by material, so each material's code runs over many paths in a row
+        std::stable_sort(paths.active.begin(), paths.active.end(),
+                         [&paths](int a, int b) {return paths.material(a) < paths.material(b);});
+
+        size_t numActive = 0;
+        for (int k : paths.active)
+        {
+            Color3f & throughput = paths.throughput[k];
+            if (!paths.found[k])
+            {
+                colors[k] += throughput * scene.background();
+                continue;
+            }
+
+            // the same decisions, in the same order, as PathTracerMaterials::shade
+            const HitInfo & hit = paths.hits[k];
+            const Ray3f & ray = paths.rays[k];
+            Color3f emit = hit.mat->emitted(ray, hit);
+            ScatterRecord srec;
+            if (hit.mat->sample(ray.d, hit, srec, samplers[k]) && depth < m_maxBounces)
+            {
+                throughput *= hit.mat->eval(ray.d, srec.scattered, hit) /
+                              hit.mat->pdf(ray.d, srec.scattered, hit);
+                paths.rays[k] = Ray3f(hit.p, srec.scattered);
+            }
+            else
+            {
+                colors[k] += throughput * emit;
+                Ray3f scattered;
+                Color3f attenuation;
+                if (depth >= m_maxBounces || !hit.mat->scatter(ray, hit, attenuation, scattered, samplers[k]))
+                    continue;
+                throughput *= attenuation;
+                paths.rays[k] = scattered;
+            }
+
+            if (depth < m_rouletteDepth || russianRoulette(throughput, samplers[k]))
+                paths.active[numActive++] = k;
+        }
+        paths.active.resize(numActive);
+    }
+}